@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "audio.h"
+
+#ifdef CHIP8_HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#define RING_SIZE 8192 // Samples, a power of two
+#define CHUNK_SIZE 256
+#define AMPLITUDE 4000
+
+typedef struct audio
+{
+    const AudioSink* pSink;
+    void* pState;
+    int ips;
+    uint64_t position;   // Next sample to synthesize
+    uint64_t tone_start; // Sample the current tone started on, the wave's phase is counted from it
+    uint64_t tone_end;   // Sample the tone stops on
+    int16_t ring[RING_SIZE];
+    atomic_uint head; // Next sample to play, only written by the output thread
+    atomic_uint tail; // Next free slot, only written by the emulation thread
+    atomic_int running;
+    pthread_t thread;
+} Audio;
+
+static void audio_sleep(void)
+{
+    struct timespec wait = {0, 1000000};
+    nanosleep(&wait, NULL);
+}
+
+static void audio_push(Audio* pAudio, const int16_t* samples, int count)
+{
+    unsigned int tail = atomic_load_explicit(&pAudio->tail, memory_order_relaxed);
+    for (int i = 0; i < count; i++)
+    {
+        while (tail - atomic_load_explicit(&pAudio->head, memory_order_acquire) == RING_SIZE)
+        {
+            // A realtime sink that fell behind loses samples, a file sink gets every one of them
+            if (pAudio->pSink->realtime)
+                return;
+            audio_sleep();
+        }
+        pAudio->ring[tail % RING_SIZE] = samples[i];
+        atomic_store_explicit(&pAudio->tail, ++tail, memory_order_release);
+    }
+}
+
+static int audio_pop(Audio* pAudio, int16_t* samples, int count)
+{
+    unsigned int head = atomic_load_explicit(&pAudio->head, memory_order_relaxed);
+    unsigned int available = atomic_load_explicit(&pAudio->tail, memory_order_acquire) - head;
+    if (available < (unsigned int)count)
+        count = available;
+    for (int i = 0; i < count; i++)
+        samples[i] = pAudio->ring[(head + i) % RING_SIZE];
+    atomic_store_explicit(&pAudio->head, head + count, memory_order_release);
+    return count;
+}
+
+// Output thread, drains the ring into the sink until audio_destroy and the ring is empty
+static void* audio_output(void* arg)
+{
+    Audio* pAudio = (Audio*)arg;
+    int16_t chunk[CHUNK_SIZE];
+    for (;;)
+    {
+        int count = audio_pop(pAudio, chunk, CHUNK_SIZE);
+        if (count > 0)
+            pAudio->pSink->write(pAudio->pState, chunk, count);
+        else if (!atomic_load(&pAudio->running))
+            break;
+        else if (pAudio->pSink->realtime)
+        {
+            // Nothing synthesized yet, keep the device fed, its blocking write paces this thread
+            memset(chunk, 0, sizeof(chunk));
+            pAudio->pSink->write(pAudio->pState, chunk, CHUNK_SIZE);
+        }
+        else
+            audio_sleep();
+    }
+    return NULL;
+}
+
+AUDIO audio_init_default(const AudioSink* pSink, const char* path, int ips)
+{
+    Audio* pAudio = (Audio*)calloc(1, sizeof(Audio));
+    if (pAudio != NULL)
+    {
+        pAudio->pSink = pSink;
+        pAudio->ips = ips;
+        pAudio->pState = pSink->open(path);
+        if (pAudio->pState == NULL)
+        {
+            free(pAudio);
+            return NULL;
+        }
+        atomic_init(&pAudio->head, 0);
+        atomic_init(&pAudio->tail, 0);
+        atomic_init(&pAudio->running, 1);
+        if (pthread_create(&pAudio->thread, NULL, audio_output, pAudio) != 0)
+        {
+            pSink->close(pAudio->pState);
+            free(pAudio);
+            return NULL;
+        }
+    }
+    return pAudio;
+}
+
+void audio_update(AUDIO hAudio, uint64_t cycle, int sound_cycles)
+{
+    Audio* pAudio = (Audio*)hAudio;
+    uint64_t end = cycle * AUDIO_SAMPLE_RATE / pAudio->ips;
+    int16_t chunk[CHUNK_SIZE];
+    int count = 0;
+
+    while (pAudio->position < end)
+    {
+        int16_t sample = 0;
+        if (pAudio->position < pAudio->tone_end)
+        {
+            // Square wave, high for the first half of each period
+            uint64_t phase = (pAudio->position - pAudio->tone_start) * AUDIO_TONE * 2 / AUDIO_SAMPLE_RATE;
+            sample = phase & 1 ? -AMPLITUDE : AMPLITUDE;
+        }
+        chunk[count++] = sample;
+        pAudio->position++;
+        if (count == CHUNK_SIZE)
+        {
+            audio_push(pAudio, chunk, count);
+            count = 0;
+        }
+    }
+    audio_push(pAudio, chunk, count);
+
+    // A tone that was already playing carries on with the same phase when its length changes
+    if (sound_cycles > 0 && pAudio->position >= pAudio->tone_end)
+        pAudio->tone_start = pAudio->position;
+    pAudio->tone_end = (cycle + sound_cycles) * AUDIO_SAMPLE_RATE / pAudio->ips;
+}
+
+void audio_destroy(AUDIO* phAudio)
+{
+    Audio* pAudio = (Audio*)*phAudio;
+    atomic_store(&pAudio->running, 0);
+    pthread_join(pAudio->thread, NULL);
+    pAudio->pSink->close(pAudio->pState);
+    free(pAudio);
+    *phAudio = NULL;
+}
+
+// Null sink
+
+static void* null_open(const char* path)
+{
+    return (void*)&audio_sink_null;
+}
+
+static void null_write(void* pState, const int16_t* samples, int count)
+{
+}
+
+static void null_close(void* pState)
+{
+}
+
+const AudioSink audio_sink_null = {"null", FALSE, null_open, null_write, null_close};
+
+// WAV file sink, the sizes in the header are filled in on close
+
+static void wav_write_u32(FILE* fp, uint32_t value)
+{
+    unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, (value >> 24) & 0xFF};
+    fwrite(bytes, 1, 4, fp);
+}
+
+static void wav_write_u16(FILE* fp, uint16_t value)
+{
+    unsigned char bytes[2] = {value & 0xFF, (value >> 8) & 0xFF};
+    fwrite(bytes, 1, 2, fp);
+}
+
+static void wav_write_header(FILE* fp, uint32_t data_size)
+{
+    fwrite("RIFF", 1, 4, fp);
+    wav_write_u32(fp, 36 + data_size);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    wav_write_u32(fp, 16);
+    wav_write_u16(fp, 1); // PCM
+    wav_write_u16(fp, 1); // Mono
+    wav_write_u32(fp, AUDIO_SAMPLE_RATE);
+    wav_write_u32(fp, AUDIO_SAMPLE_RATE * 2);
+    wav_write_u16(fp, 2);
+    wav_write_u16(fp, 16);
+    fwrite("data", 1, 4, fp);
+    wav_write_u32(fp, data_size);
+}
+
+static void* wav_open(const char* path)
+{
+    FILE* fp = fopen(path, "wb");
+    if (fp != NULL)
+        wav_write_header(fp, 0);
+    return fp;
+}
+
+static void wav_write(void* pState, const int16_t* samples, int count)
+{
+    for (int i = 0; i < count; i++)
+        wav_write_u16((FILE*)pState, (uint16_t)samples[i]);
+}
+
+static void wav_close(void* pState)
+{
+    FILE* fp = (FILE*)pState;
+    long size = ftell(fp) - 44;
+    rewind(fp);
+    wav_write_header(fp, (uint32_t)size);
+    fclose(fp);
+}
+
+const AudioSink audio_sink_wav = {"wav", FALSE, wav_open, wav_write, wav_close};
+
+#ifdef CHIP8_HAVE_ALSA
+
+// ALSA sink, path picks the device and defaults to "default"
+
+static void* alsa_open(const char* path)
+{
+    snd_pcm_t* pcm;
+    if (snd_pcm_open(&pcm, path != NULL ? path : "default", SND_PCM_STREAM_PLAYBACK, 0) < 0)
+        return NULL;
+    if (snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED, 1, AUDIO_SAMPLE_RATE, 1, 50000) < 0)
+    {
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+    return pcm;
+}
+
+static void alsa_write(void* pState, const int16_t* samples, int count)
+{
+    snd_pcm_sframes_t written = snd_pcm_writei((snd_pcm_t*)pState, samples, count);
+    if (written < 0)
+        snd_pcm_recover((snd_pcm_t*)pState, (int)written, 1);
+}
+
+static void alsa_close(void* pState)
+{
+    snd_pcm_drain((snd_pcm_t*)pState);
+    snd_pcm_close((snd_pcm_t*)pState);
+}
+
+const AudioSink audio_sink_alsa = {"alsa", TRUE, alsa_open, alsa_write, alsa_close};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// Square wave beeper gated by the sound timer
+// The emulation thread synthesizes samples on the guest clock into a lock free ring buffer and an output thread
+// drains it into a sink, so the tone starts and stops on the exact sample of the cycle the timer changed on
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_TONE 440 // Hz
+
+typedef void* AUDIO;
+
+// Output for the synthesized samples, 16 bit mono at AUDIO_SAMPLE_RATE
+typedef struct audio_sink
+{
+    const char* name;
+    Boolean realtime; // Plays at the device rate, gaps are filled with silence instead of waiting for samples
+    void* (*open)(const char* path);
+    void (*write)(void* pState, const int16_t* samples, int count);
+    void (*close)(void* pState);
+} AudioSink;
+
+extern const AudioSink audio_sink_null; // Discards everything, for headless runs
+extern const AudioSink audio_sink_wav;  // Writes a WAV file to path
+#ifdef CHIP8_HAVE_ALSA
+extern const AudioSink audio_sink_alsa; // Default ALSA device
+#endif
+
+// ips is the emulated speed used to turn cycles into samples
+AUDIO audio_init_default(const AudioSink* pSink, const char* path, int ips);
+// Synthesizes up to cycle, after which the tone lasts for sound_cycles cycles (chip8_get_sound_cycles)
+void audio_update(AUDIO hAudio, uint64_t cycle, int sound_cycles);
+// Flushes the remaining samples to the sink and closes it
+void audio_destroy(AUDIO* phAudio);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "chip8.h"
+#include "lockstep.h"
+
+// Runs a rom for a fixed number of instructions on every available CPU core and prints the throughput of each
+// Given a lane count it also splits the instructions over that many instances, seeded 0 to lanes - 1, and compares
+// the lockstep engine against running them one after another
+
+#define BATCH_SIZE 1000
+
+static CHIP8 load(const char* path)
+{
+    CHIP8 hChip8 = chip8_init_default();
+    if (hChip8 == NULL)
+    {
+        printf("Failed to allocate memory a Chip8 Object!\n");
+        exit(1);
+    }
+    if (chip8_load_rom_file(hChip8, path) == FAILURE)
+    {
+        printf("Rom does not exist or failed to read!\n");
+        exit(1);
+    }
+    return hChip8;
+}
+
+static long run_cycles(CHIP8 hChip8, long cycles)
+{
+    long executed = 0;
+    while (executed < cycles)
+    {
+        int batch = cycles - executed < BATCH_SIZE ? (int)(cycles - executed) : BATCH_SIZE;
+        int done;
+        chip8_run_cycles(hChip8, batch, &done);
+        executed += done;
+    }
+    return executed;
+}
+
+// Aggregate throughput of lanes instances run one after another, and of the lockstep engine with and without AVX2
+static void bench_lanes(const char* path, int lanes, long cycles)
+{
+    CHIP8* instances = (CHIP8*)malloc(lanes * sizeof(CHIP8));
+    uint32_t* hashes = (uint32_t*)malloc(lanes * sizeof(uint32_t));
+    if (instances == NULL || hashes == NULL)
+    {
+        printf("Failed to allocate %d instances!\n", lanes);
+        exit(1);
+    }
+
+    clock_t start = clock();
+    for (int i = 0; i < lanes; i++)
+    {
+        instances[i] = load(path);
+        chip8_seed(instances[i], i);
+        chip8_set_report_unknown(instances[i], FALSE);
+    }
+    for (int i = 0; i < lanes; i++)
+    {
+        run_cycles(instances[i], cycles);
+        hashes[i] = chip8_get_state_hash(instances[i]);
+        chip8_destory(&instances[i]);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%-12s %8.1f MIPS over %d instances\n", "instances", (double)lanes * cycles / seconds / 1000000.0, lanes);
+
+    for (int vector = 1; vector >= 0; vector--)
+    {
+        start = clock();
+        LOCKSTEP hLockstep = lockstep_init_default(lanes);
+        FILE* fp = fopen(path, "rb");
+        if (hLockstep == NULL || fp == NULL || lockstep_load_rom(hLockstep, fp) == FAILURE)
+        {
+            printf("Failed to load rom into %d lanes!\n", lanes);
+            exit(1);
+        }
+        fclose(fp);
+        if (lockstep_set_vector(hLockstep, (Boolean)vector) == FAILURE)
+        {
+            printf("%-12s not available on this CPU\n", "lockstep");
+            lockstep_destroy(&hLockstep);
+            continue;
+        }
+        for (int i = 0; i < lanes; i++)
+            lockstep_seed(hLockstep, i, i);
+        for (long done = 0; done < cycles; done += BATCH_SIZE)
+            lockstep_run_cycles(hLockstep, cycles - done < BATCH_SIZE ? (int)(cycles - done) : BATCH_SIZE);
+        seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        int mismatches = 0;
+        for (int i = 0; i < lanes; i++)
+            mismatches += lockstep_get_state_hash(hLockstep, i) != hashes[i];
+        printf("%-12s %8.1f MIPS over %d lanes, AVX2 %s, %d lanes differ from the instances\n", "lockstep",
+               (double)lanes * cycles / seconds / 1000000.0, lanes, vector ? "on" : "off", mismatches);
+        lockstep_print_stats(hLockstep);
+        lockstep_destroy(&hLockstep);
+    }
+    free(instances);
+    free(hashes);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("Program Usage: CHIP8_BENCH <rom_path> [instructions] [lanes]\n");
+        exit(1);
+    }
+    long cycles = argc > 2 ? atol(argv[2]) : 100000000;
+    const char* names[] = {"interpreter", "jit", "threaded"};
+    Core cores[] = {CORE_INTERPRETER, CORE_JIT, CORE_THREADED};
+
+    for (int i = 0; i < 3; i++)
+    {
+        CHIP8 hChip8 = load(argv[1]);
+        if (chip8_set_core(hChip8, cores[i]) == FAILURE)
+        {
+            printf("%-12s not available in this build\n", names[i]);
+            chip8_destory(&hChip8);
+            continue;
+        }
+
+        clock_t start = clock();
+        long executed = run_cycles(hChip8, cycles);
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("%-12s %8.1f MIPS\n", names[i], executed / seconds / 1000000.0);
+        chip8_destory(&hChip8);
+    }
+
+    int lanes = argc > 3 ? atoi(argv[3]) : 0;
+    if (lanes > 0)
+        bench_lanes(argv[1], lanes, cycles / lanes);
+    return 0;
+}
@@ -1,22 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 #include "chip8.h"
-
-typedef struct chip8
-{
-    unsigned short opcode;
-    unsigned char* memory;
-    unsigned char* V;
-    unsigned short I;
-    unsigned short pc;
-    unsigned char* gfx;
-    unsigned short* stack;
-    unsigned short sp;
-    unsigned char* key;
-    Boolean draw_flag;
-    unsigned char delay_timer;
-    unsigned char sound_timer;
-} Chip8;
+#include "chip8_internal.h"
+#include "chip8_ops.h"
 
 // Chip8 Fontset
 unsigned char chip8_fontset[80] =
@@ -39,387 +34,948 @@ unsigned char chip8_fontset[80] =
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-CHIP8 chip8_init_default(void)
+// Opcode to handler table shared by every instance and core, filled by the first chip8_init_default
+unsigned char chip8_handlers[0x10000];
+static atomic_int handlers_state; // 0 not built, 1 being built, 2 ready
+
+// Images by hash, guarded by images_lock since instances are created and destroyed on several threads
+// Images no instance uses any more stay cached, up to rom_cache_size of them, so batches that load the same
+// roms over and over find them already built
+#define IMAGE_BUCKETS 256
+static Image* image_buckets[IMAGE_BUCKETS];
+static Image* idle_oldest;
+static Image* idle_newest;
+static int idle_images;
+static int rom_cache_size = 64;
+static atomic_flag images_lock = ATOMIC_FLAG_INIT;
+static Image* blank_image; // Font and no rom, what new instances start with, never released
+
+
+// Blocks of one size kept once freed, so instances forked and dropped by a search reuse them instead of
+// going back to malloc every time
+typedef struct pool
 {
-    Chip8* pChip8 = (Chip8*)malloc(sizeof(Chip8));
-    if (pChip8 != NULL)
+    void* free; // Each free block starts with a pointer to the next one
+    int count;
+    atomic_flag lock;
+} Pool;
+
+#define POOL_LIMIT 1024 // Blocks kept per pool, any more are freed
+
+static Pool instance_pool = {NULL, 0, ATOMIC_FLAG_INIT};
+static Pool page_pool = {NULL, 0, ATOMIC_FLAG_INIT};
+static Pool decoded_pool = {NULL, 0, ATOMIC_FLAG_INIT};
+
+static Image* chip8_acquire_image(const unsigned char* memory);
+
+// Guards short critical sections, instances are created and destroyed on several threads
+static void chip8_lock(atomic_flag* pLock)
+{
+    while (atomic_flag_test_and_set_explicit(pLock, memory_order_acquire))
+        ;
+}
+
+static void chip8_unlock(atomic_flag* pLock)
+{
+    atomic_flag_clear_explicit(pLock, memory_order_release);
+}
+
+static void* chip8_pool_take(Pool* pPool)
+{
+    chip8_lock(&pPool->lock);
+    void* pBlock = pPool->free;
+    if (pBlock != NULL)
+    {
+        pPool->free = *(void**)pBlock;
+        pPool->count--;
+    }
+    chip8_unlock(&pPool->lock);
+    return pBlock;
+}
+
+// Returns FALSE when the pool is full and the caller has to free the block itself
+static Boolean chip8_pool_give(Pool* pPool, void* pBlock)
+{
+    chip8_lock(&pPool->lock);
+    Boolean kept = pPool->count < POOL_LIMIT;
+    if (kept)
     {
-        pChip8->opcode = 0;
-        pChip8->memory = (unsigned char*)calloc(sizeof(unsigned char) * MEMORY_SIZE, sizeof(unsigned char));
-        if (pChip8->memory == NULL)
+        *(void**)pBlock = pPool->free;
+        pPool->free = pBlock;
+        pPool->count++;
+    }
+    chip8_unlock(&pPool->lock);
+    return kept;
+}
+
+// Allocates size bytes aligned to a cache line, freed with chip8_free_aligned
+static void* chip8_alloc_aligned(size_t size)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, CACHE_LINE_SIZE);
+#else
+    return aligned_alloc(CACHE_LINE_SIZE, (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+#endif
+}
+
+static void chip8_free_aligned(void* pBlock)
+{
+#ifdef _WIN32
+    _aligned_free(pBlock);
+#else
+    free(pBlock);
+#endif
+}
+
+static Chip8* chip8_alloc_instance(void)
+{
+    Chip8* pChip8 = (Chip8*)chip8_pool_take(&instance_pool);
+    return pChip8 != NULL ? pChip8 : (Chip8*)chip8_alloc_aligned(sizeof(Chip8));
+}
+
+static void chip8_free_instance(Chip8* pChip8)
+{
+    if (!chip8_pool_give(&instance_pool, pChip8))
+        chip8_free_aligned(pChip8);
+}
+
+static unsigned char* chip8_alloc_page(void)
+{
+    unsigned char* pPage = (unsigned char*)chip8_pool_take(&page_pool);
+    return pPage != NULL ? pPage : (unsigned char*)malloc(MEMORY_PAGE_SIZE);
+}
+
+static void chip8_free_page(unsigned char* pPage)
+{
+    if (!chip8_pool_give(&page_pool, pPage))
+        free(pPage);
+}
+
+static Instruction* chip8_alloc_decoded(void)
+{
+    Instruction* decoded = (Instruction*)chip8_pool_take(&decoded_pool);
+    return decoded != NULL ? decoded : (Instruction*)malloc(MEMORY_SIZE * sizeof(Instruction));
+}
+
+static void chip8_free_decoded(Instruction* decoded)
+{
+    if (!chip8_pool_give(&decoded_pool, decoded))
+        free(decoded);
+}
+
+static Op chip8_handler_of(unsigned short opcode)
+{
+    // Opcodes from https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
+    Op op = OP_UNKNOWN;
+    switch (opcode & 0xF000)
+    {
+    case 0x0000:
+        switch (opcode & 0x000F)
         {
-            free(pChip8);
-            return NULL;
+            case 0x0000: op = OP_00E0; break;
+            case 0x000E: op = OP_00EE; break;
         }
-        pChip8->V = (unsigned char*)calloc(sizeof(unsigned char) * CPU_REGISTERS, sizeof(unsigned char));
-        if (pChip8->V == NULL)
+        break;
+    case 0x1000: op = OP_1NNN; break;
+    case 0x2000: op = OP_2NNN; break;
+    case 0x3000: op = OP_3XNN; break;
+    case 0x4000: op = OP_4XNN; break;
+    case 0x5000: op = OP_5XY0; break;
+    case 0x6000: op = OP_6XNN; break;
+    case 0x7000: op = OP_7XNN; break;
+    case 0x8000:
+        switch (opcode & 0x000F)
         {
-            free(pChip8->memory);
-            free(pChip8);
-            return NULL;
+            case 0x0000: op = OP_8XY0; break;
+            case 0x0001: op = OP_8XY1; break;
+            case 0x0002: op = OP_8XY2; break;
+            case 0x0003: op = OP_8XY3; break;
+            case 0x0004: op = OP_8XY4; break;
+            case 0x0005: op = OP_8XY5; break;
+            case 0x0006: op = OP_8XY6; break;
+            case 0x0007: op = OP_8XY7; break;
+            case 0x000E: op = OP_8XYE; break;
         }
-        pChip8->I = 0;
-        pChip8->pc = 0x200;
-        pChip8->gfx = (unsigned char*)calloc((SCREEN_WIDTH * SCREEN_HEIGHT) * sizeof(unsigned char), sizeof(unsigned char));
-        if (pChip8->gfx == NULL)
+        break;
+    case 0x9000: op = OP_9XY0; break;
+    case 0xA000: op = OP_ANNN; break;
+    case 0xB000: op = OP_BNNN; break;
+    case 0xC000: op = OP_CXNN; break;
+    case 0xD000: op = OP_DXYN; break;
+    case 0xE000:
+        switch (opcode & 0x00FF)
         {
-			free(pChip8->V);
-			free(pChip8->memory);
-            free(pChip8);
-            return NULL;
+            case 0x009E: op = OP_EX9E; break;
+            case 0x00A1: op = OP_EXA1; break;
         }
-        pChip8->stack = (unsigned short*)calloc(sizeof(unsigned short) * STACK_SIZE, sizeof(unsigned char));
-		if (pChip8->stack == NULL)
-		{
-			free(pChip8->gfx);
-			free(pChip8->V);
-			free(pChip8->memory);
-            free(pChip8);
-			return NULL;
-		}
-        pChip8->sp = 0;
-        pChip8->key = (unsigned char*)calloc(sizeof(unsigned char) * NUM_OF_KEYS, sizeof(unsigned char));
-		if (pChip8->key == NULL)
-		{
-			free(pChip8->stack);
-			free(pChip8->gfx);
-			free(pChip8->V);
-			free(pChip8->memory);
-            free(pChip8);
-            return NULL;
-		}
-        pChip8->draw_flag = FALSE;
-        pChip8->delay_timer = 0;
-        pChip8->sound_timer = 0;
-        // Load font into memory
-        for (int i = 0; i < 80; i++)
-            pChip8->memory[i] = chip8_fontset[i];
+        break;
+    case 0xF000:
+        switch (opcode & 0x00FF)
+        {
+            case 0x0007: op = OP_FX07; break;
+            case 0x000A: op = OP_FX0A; break;
+            case 0x0015: op = OP_FX15; break;
+            case 0x0018: op = OP_FX18; break;
+            case 0x001E: op = OP_FX1E; break;
+            case 0x0029: op = OP_FX29; break;
+            case 0x0033: op = OP_FX33; break;
+            case 0x0055: op = OP_FX55; break;
+            case 0x0065: op = OP_FX65; break;
+        }
+        break;
     }
-    return pChip8;
+
+    return op;
 }
 
-Status chip8_load_rom(CHIP8 hChip8, FILE* fp)
+// Builds the table once, instances can be created on several threads at the same time
+static void chip8_init_handlers(void)
 {
-    Chip8* pChip8 = (Chip8*)hChip8;
-    fseek(fp, 0, SEEK_END);
-    long rom_size = ftell(fp);
-    rewind(fp);
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&handlers_state, &expected, 1))
+    {
+        for (int opcode = 0; opcode <= 0xFFFF; opcode++)
+            chip8_handlers[opcode] = chip8_handler_of(opcode);
+        unsigned char memory[MEMORY_SIZE] = {0};
+        memcpy(memory, chip8_fontset, sizeof(chip8_fontset));
+        blank_image = chip8_acquire_image(memory);
+        atomic_store(&handlers_state, 2);
+    }
+    while (atomic_load(&handlers_state) != 2)
+        ; // Another thread is building it
+}
+
+void chip8_decode(unsigned short opcode, Instruction* pInstruction)
+{
+    pInstruction->op = chip8_handlers[opcode];
+    pInstruction->x = (opcode & 0x0F00) >> 8;
+    pInstruction->y = (opcode & 0x00F0) >> 4;
+    pInstruction->n = opcode & 0x000F;
+    pInstruction->nn = opcode & 0x00FF;
+    pInstruction->nnn = opcode & 0x0FFF;
+}
+
+static unsigned char chip8_byte_at(unsigned char* const* pages, int address)
+{
+    return pages[(address >> MEMORY_PAGE_SHIFT) & (MEMORY_PAGES - 1)][address & (MEMORY_PAGE_SIZE - 1)];
+}
+
+static unsigned short chip8_opcode_at(unsigned char* const* pages, int address)
+{
+    return chip8_byte_at(pages, address) << 8 | chip8_byte_at(pages, address + 1);
+}
+
+// Delay loop polling the delay timer until it reaches zero: FX07, 3X00, 1NNN back to the FX07
+static Boolean chip8_is_delay_loop(unsigned char* const* pages, int address)
+{
+    if (address < 0 || address + 5 >= MEMORY_SIZE)
+        return FALSE;
+    unsigned short opcode = chip8_opcode_at(pages, address);
+    return (opcode & 0xF0FF) == 0xF007 &&
+           chip8_opcode_at(pages, address + 2) == (0x3000 | (opcode & 0x0F00)) &&
+           chip8_opcode_at(pages, address + 4) == (0x1000 | address);
+}
 
-    char* buffer = (char*)malloc(sizeof(char) * rom_size);
-    if (buffer == NULL)
+// Decodes the instruction at address, a 1NNN jumping to itself or closing a delay loop becomes OP_IDLE
+static void chip8_decode_in(unsigned char* const* pages, Instruction* decoded, int address)
+{
+    Instruction* pInstruction = &decoded[address];
+    chip8_decode(chip8_opcode_at(pages, address), pInstruction);
+    if (pInstruction->op == OP_1NNN &&
+        (pInstruction->nnn == address || (pInstruction->nnn == address - 4 && chip8_is_delay_loop(pages, address - 4))))
+        pInstruction->op = OP_IDLE;
+}
+
+// Copies the image's instructions for the instance to change, returns them or NULL when out of memory
+static Instruction* chip8_own_decoded(Chip8* pChip8)
+{
+    if (pChip8->decoded != pChip8->image->decoded)
+        return pChip8->decoded;
+    Instruction* decoded = chip8_alloc_decoded();
+    if (decoded == NULL)
     {
-        return FAILURE;
+        printf("Failed to allocate decoded instructions, code written to memory is not picked up!\n");
+        return NULL;
+    }
+    memcpy(decoded, pChip8->image->decoded, sizeof(pChip8->image->decoded));
+    pChip8->decoded = decoded;
+    return decoded;
+}
+
+// The image's instructions are decoded in full when it is built, so this only runs on the instance's own copy
+void chip8_decode_at(Chip8* pChip8, unsigned short address)
+{
+    Instruction* decoded = chip8_own_decoded(pChip8);
+    if (decoded != NULL)
+        chip8_decode_in(pChip8->pages, decoded, address & (MEMORY_SIZE - 1));
+}
+
+// Skips up to budget cycles of the idle loop starting at pc, returns how many were skipped
+// The loop is checked again since OP_IDLE is only a hint, the bytes before the jump may have been written since it was decoded
+static int chip8_fast_forward(Chip8* pChip8, int budget)
+{
+    unsigned short pc = pChip8->pc;
+    if (pc + 1 >= MEMORY_SIZE)
+        return 0;
+
+    // Jump to itself, nothing can ever change so the whole budget is spent here
+    if (chip8_opcode_at(pChip8->pages, pc) == (0x1000 | pc))
+    {
+        chip8_advance_clock(pChip8, budget);
+        return budget;
     }
-    size_t buffer_size = fread(buffer, 1, rom_size, fp);
-    if (buffer_size != rom_size)
+
+    // Delay loop, every 3 cycle iteration that reads a non zero delay timer comes back to pc, only the
+    // last iteration's FX07 is visible afterwards
+    if (chip8_is_delay_loop(pChip8->pages, pc) && pChip8->delay_timer > 0)
     {
-        return FAILURE;
+        int x = chip8_read(pChip8, pc) & 0x0F;
+        long long zero_after = pChip8->tick_cycles_left + (long long)(pChip8->delay_timer - 1) * pChip8->cycles_per_tick;
+        long long iterations = (zero_after - 1) / 3 + 1;
+        if (iterations > budget / 3)
+            iterations = budget / 3;
+        if (iterations == 0)
+            return 0;
+        chip8_advance_clock(pChip8, (int)(iterations - 1) * 3);
+        pChip8->V[x] = pChip8->delay_timer;
+        chip8_advance_clock(pChip8, 3);
+        return (int)iterations * 3;
     }
+    return 0;
+}
 
-    if (MEMORY_SIZE - 0x200 > rom_size)
+// Drops the predecoded instructions overlapping [address, address + length) after memory is written
+// The instruction starting one byte before the write shares its second byte with the written range
+void chip8_invalidate(Chip8* pChip8, int address, int length)
+{
+    address &= MEMORY_SIZE - 1;
+    if (pChip8->decoded == pChip8->image->decoded)
     {
-        for (int i = 0; i < rom_size; i++)
+        // Memory has only ever held the image's bytes, so the image's instructions and compiled blocks still hold
+        // until a write changes one of them
+        Boolean changed = FALSE;
+        for (int i = address; i < address + length && !changed; i++)
         {
-            pChip8->memory[i + 0x200] = buffer[i];
+            int at = i & (MEMORY_SIZE - 1);
+            changed = chip8_read(pChip8, at) != pChip8->image->memory[at >> MEMORY_PAGE_SHIFT][at & (MEMORY_PAGE_SIZE - 1)];
         }
+        if (!changed || chip8_own_decoded(pChip8) == NULL)
+            return;
+    }
+    for (int i = address - 1; i < address + length; i++)
+        pChip8->decoded[i & (MEMORY_SIZE - 1)].op = OP_UNDECODED;
+    if (pChip8->jit != NULL)
+    {
+        chip8_jit_invalidate(pChip8->jit, address, length);
+        if (address + length > MEMORY_SIZE)
+            chip8_jit_invalidate(pChip8->jit, 0, address + length - MEMORY_SIZE);
+    }
+}
+
+// FNV over whole words in four lanes, the same bytes always hash the same but the result is not stored anywhere
+static uint32_t chip8_hash_memory(const unsigned char* memory)
+{
+    uint64_t h0 = 0xCBF29CE484222325ULL, h1 = 0x84222325CBF29CE4ULL, h2 = 0x9CE484222325CBF2ULL, h3 = 0x2325CBF29CE48422ULL;
+    for (int i = 0; i < MEMORY_SIZE; i += 4 * sizeof(uint64_t))
+    {
+        uint64_t word[4];
+        memcpy(word, memory + i, sizeof(word));
+        h0 = (h0 ^ word[0]) * 0x100000001B3ULL;
+        h1 = (h1 ^ word[1]) * 0x100000001B3ULL;
+        h2 = (h2 ^ word[2]) * 0x100000001B3ULL;
+        h3 = (h3 ^ word[3]) * 0x100000001B3ULL;
     }
+    uint64_t hash = h0 ^ (h1 * 3) ^ (h2 * 5) ^ (h3 * 7);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static void chip8_unlink_idle(Image* pImage)
+{
+    if (pImage->older != NULL)
+        pImage->older->newer = pImage->newer;
+    else
+        idle_oldest = pImage->newer;
+    if (pImage->newer != NULL)
+        pImage->newer->older = pImage->older;
     else
+        idle_newest = pImage->older;
+    idle_images--;
+}
+
+// Frees the oldest idle images until no more than rom_cache_size are left, called with images_lock held
+static void chip8_trim_images(void)
+{
+    while (idle_images > rom_cache_size)
     {
-        return FAILURE;
+        Image* pImage = idle_oldest;
+        chip8_unlink_idle(pImage);
+        Image** ppLink = &image_buckets[pImage->hash % IMAGE_BUCKETS];
+        while (*ppLink != pImage)
+            ppLink = &(*ppLink)->next;
+        *ppLink = pImage->next;
+        free(pImage);
     }
+}
+
+// Returns the image holding memory with a reference taken, building it when no instance has loaded the same bytes
+static Image* chip8_acquire_image(const unsigned char* memory)
+{
+    uint32_t hash = chip8_hash_memory(memory);
+    chip8_lock(&images_lock); // Held for a bucket walk or building one image
+    Image* pImage = image_buckets[hash % IMAGE_BUCKETS];
+    while (pImage != NULL && (pImage->hash != hash || memcmp(pImage->memory, memory, MEMORY_SIZE) != 0))
+        pImage = pImage->next;
+
+    if (pImage == NULL && (pImage = (Image*)malloc(sizeof(Image))) != NULL)
+    {
+        unsigned char* pages[MEMORY_PAGES];
+        memcpy(pImage->memory, memory, MEMORY_SIZE);
+        for (int page = 0; page < MEMORY_PAGES; page++)
+            pages[page] = pImage->memory[page];
+        // Most of memory is zeros past the end of the rom, those all decode to the same instruction
+        Instruction zero;
+        chip8_decode(0x0000, &zero);
+        for (int address = 0; address < MEMORY_SIZE; address++)
+        {
+            if (memory[address] == 0 && memory[(address + 1) & (MEMORY_SIZE - 1)] == 0)
+                pImage->decoded[address] = zero;
+            else
+                chip8_decode_in(pages, pImage->decoded, address);
+        }
+        pImage->hash = hash;
+        pImage->references = 0;
+        pImage->next = image_buckets[hash % IMAGE_BUCKETS];
+        image_buckets[hash % IMAGE_BUCKETS] = pImage;
+    }
+    else if (pImage != NULL && pImage->references == 0)
+        chip8_unlink_idle(pImage);
+    if (pImage != NULL)
+        pImage->references++;
+    chip8_unlock(&images_lock);
+    return pImage;
+}
+
+static void chip8_retain_image(Image* pImage)
+{
+    chip8_lock(&images_lock);
+    pImage->references++;
+    chip8_unlock(&images_lock);
+}
+
+static void chip8_release_image(Image* pImage)
+{
+    chip8_lock(&images_lock);
+    if (--pImage->references == 0)
+    {
+        // Newest in the cache, pushing the oldest one out when it is full
+        pImage->older = idle_newest;
+        pImage->newer = NULL;
+        if (idle_newest != NULL)
+            idle_newest->newer = pImage;
+        else
+            idle_oldest = pImage;
+        idle_newest = pImage;
+        idle_images++;
+        chip8_trim_images();
+    }
+    chip8_unlock(&images_lock);
+}
+
+// Drops the instance's pages and instructions and points them at pImage, whose reference the instance takes over
+static void chip8_attach_image(Chip8* pChip8, Image* pImage)
+{
+    for (int page = 0; page < MEMORY_PAGES; page++)
+    {
+        if (pChip8->private_pages & (1u << page))
+            chip8_free_page(pChip8->pages[page]);
+        pChip8->pages[page] = pImage->memory[page];
+    }
+    pChip8->private_pages = 0;
+    if (pChip8->image != NULL)
+    {
+        if (pChip8->decoded != pChip8->image->decoded)
+            chip8_free_decoded(pChip8->decoded);
+        chip8_release_image(pChip8->image);
+    }
+    pChip8->image = pImage;
+    pChip8->decoded = pImage->decoded;
+    if (pChip8->jit != NULL)
+        chip8_jit_invalidate(pChip8->jit, 0, MEMORY_SIZE);
+}
 
-    free(buffer);
+unsigned char* chip8_own_page(Chip8* pChip8, int page)
+{
+    if (pChip8->private_pages & (1u << page))
+        return pChip8->pages[page];
+    unsigned char* pPage = chip8_alloc_page();
+    if (pPage == NULL)
+    {
+        printf("Failed to allocate memory page %d, writes to it are dropped!\n", page);
+        return NULL;
+    }
+    memcpy(pPage, pChip8->pages[page], MEMORY_PAGE_SIZE);
+    pChip8->pages[page] = pPage;
+    pChip8->private_pages |= 1u << page;
+    return pPage;
+}
+
+void chip8_set_page(Chip8* pChip8, int page, const unsigned char* bytes)
+{
+    unsigned char* pShared = pChip8->image->memory[page];
+    if (memcmp(pShared, bytes, MEMORY_PAGE_SIZE) == 0)
+    {
+        if (pChip8->private_pages & (1u << page))
+            chip8_free_page(pChip8->pages[page]);
+        pChip8->pages[page] = pShared;
+        pChip8->private_pages &= ~(1u << page);
+    }
+    else
+    {
+        unsigned char* pPage = chip8_own_page(pChip8, page);
+        if (pPage == NULL)
+            return;
+        memcpy(pPage, bytes, MEMORY_PAGE_SIZE);
+    }
+    chip8_invalidate(pChip8, page * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+}
+
+void chip8_share_rom(Chip8* pChip8, Chip8* pSource)
+{
+    chip8_retain_image(pSource->image);
+    chip8_attach_image(pChip8, pSource->image);
+}
+
+CHIP8 chip8_init_default(void)
+{
+    if (atomic_load_explicit(&handlers_state, memory_order_acquire) != 2)
+        chip8_init_handlers();
+
+    Chip8* pChip8 = chip8_alloc_instance();
+    if (pChip8 != NULL && blank_image == NULL)
+    {
+        chip8_free_instance(pChip8);
+        pChip8 = NULL;
+    }
+    if (pChip8 != NULL)
+    {
+        memset(pChip8, 0, sizeof(Chip8));
+        pChip8->pc = 0x200;
+        pChip8->cycles_per_tick = CYCLES_PER_FRAME;
+        pChip8->tick_cycles_left = CYCLES_PER_FRAME;
+        pChip8->cycles_per_frame = CYCLES_PER_FRAME;
+        pChip8->frame_cycles_left = -1;
+        pChip8->core = CHIP8_DEFAULT_CORE;
+        pChip8->jit = NULL;
+        pChip8->report_unknown = TRUE;
+        chip8_seed(pChip8, 0);
+        // Memory starts out as the font, shared with every other instance until a rom is loaded
+        chip8_retain_image(blank_image);
+        chip8_attach_image(pChip8, blank_image);
+    }
+    return pChip8;
+}
+
+// Makes memory, the font followed by a rom, what the instance runs
+static Status chip8_load_memory(Chip8* pChip8, const unsigned char* memory)
+{
+    Image* pImage = chip8_acquire_image(memory);
+    if (pImage == NULL)
+        return FAILURE;
+    chip8_attach_image(pChip8, pImage);
     return SUCCESS;
 }
 
-void chip8_emulate_cycle(CHIP8 hChip8)
+// Reads the rom straight into place after the font, nothing seeks so pipes and stdin work too
+Status chip8_load_rom(CHIP8 hChip8, FILE* fp)
 {
     Chip8* pChip8 = (Chip8*)hChip8;
-    // Fetch Opcode
-    pChip8->opcode = pChip8->memory[pChip8->pc] << 8 | pChip8->memory[pChip8->pc + 1];
-    // Decode and Execute Opcode
-    // Opcodes from https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
-    switch (pChip8->opcode & 0xF000)
+    unsigned char memory[MEMORY_SIZE] = {0};
+    memcpy(memory, chip8_fontset, sizeof(chip8_fontset));
+    size_t size = 0;
+    size_t read;
+    while (size < MEMORY_SIZE - 0x200 && (read = fread(memory + 0x200 + size, 1, MEMORY_SIZE - 0x200 - size, fp)) > 0)
+        size += read;
+    if (ferror(fp) || (size == MEMORY_SIZE - 0x200 && fgetc(fp) != EOF))
+        return FAILURE;
+    return chip8_load_memory(pChip8, memory);
+}
+
+Status chip8_load_rom_memory(CHIP8 hChip8, const void* rom, size_t size)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    if (size > MEMORY_SIZE - 0x200)
+        return FAILURE;
+    unsigned char memory[MEMORY_SIZE] = {0};
+    memcpy(memory, chip8_fontset, sizeof(chip8_fontset));
+    if (size > 0)
+        memcpy(memory + 0x200, rom, size);
+    return chip8_load_memory(pChip8, memory);
+}
+
+// Regular files are read straight into memory with one read, anything else is read as a stream
+// Roms are too small for mapping them to pay off, a map and unmap cost more than the copy they save
+Status chip8_load_rom_file(CHIP8 hChip8, const char* path)
+{
+    if (!strcmp(path, "-"))
+        return chip8_load_rom(hChip8, stdin);
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FAILURE;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
     {
-    case 0x0000: // 0NNN - Calls machine code routine at NNN
-        switch (pChip8->opcode & 0x000F)
+        Chip8* pChip8 = (Chip8*)hChip8;
+        Status status = FAILURE;
+        if (info.st_size <= MEMORY_SIZE - 0x200)
         {
-            case 0x0000: // 00E0 - Clears the Screen
-                for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
-                {
-                    pChip8->gfx[i] = 0;
-                }
-                pChip8->draw_flag = TRUE;
-                pChip8->pc += 2;
-                break;
-            case 0x000E: // 00EE - Returns from a Subroutine
-                pChip8->sp--;
-                pChip8->pc = pChip8->stack[pChip8->sp];
-                pChip8->pc += 2;
-                break;
-            default:
-                printf("Unknown Opcode [0x0000]: 0x%x\n", pChip8->opcode);
+            unsigned char memory[MEMORY_SIZE] = {0};
+            memcpy(memory, chip8_fontset, sizeof(chip8_fontset));
+            ssize_t size = 0;
+            ssize_t read_size = 1;
+            while (size < info.st_size && (read_size = read(fd, memory + 0x200 + size, info.st_size - size)) > 0)
+                size += read_size;
+            if (read_size >= 0)
+                status = chip8_load_memory(pChip8, memory);
         }
-        break;
-    case 0x1000: // 1NNN - Jumps to address NNN
-        pChip8->pc = pChip8->opcode & 0x0FFF;
-        break;
-    case 0x2000: // 2NNN - Calls subroutine at NNN
-        pChip8->stack[pChip8->sp] = pChip8->pc;
-        pChip8->sp++;
-        pChip8->pc = pChip8->opcode & 0x0FFF;
-        break;
-    case 0x3000: // 3XNN - Skips the next instruction if VX equals NN (usually the next instruction is a jump to skip a code block)
-        if ((pChip8->V[(pChip8->opcode & 0x0F00) >> 8]) == (pChip8->opcode & 0x00FF))
-            pChip8->pc += 4;
-        else
-            pChip8->pc += 2;
-        break;
-    case 0x4000: // 4XNN - Skips the next instruction if VX does not equal NN (usually the next instruction is a jump to skip a code block)
-        if ((pChip8->V[(pChip8->opcode & 0x0F00) >> 8]) != (pChip8->opcode & 0x00FF))
-            pChip8->pc += 4;
-        else
-            pChip8->pc += 2;
-        break;
-    case 0x5000: // 5XY0 - Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block)
-        if ((pChip8->V[(pChip8->opcode & 0x0F00) >> 8]) == (pChip8->V[(pChip8->opcode & 0x00F0) >> 4]))
-            pChip8->pc += 4;
-        else
-            pChip8->pc += 2;
-        break;
-    case 0x6000: // 6XNN - Sets VX to NN
-        pChip8->V[(pChip8->opcode & 0x0F00) >> 8] = pChip8->opcode & 0x00FF;
-        pChip8->pc += 2;
-        break;
-    case 0x7000: // 7XNN - Adds NN to VX (carry flag is not changed)
-        pChip8->V[(pChip8->opcode & 0x0F00) >> 8] += pChip8->opcode & 0x00FF;
-        pChip8->pc += 2;
-        break;
-    case 0x8000:
-        switch(pChip8->opcode & 0x000F)
+        close(fd);
+        return status;
+    }
+    FILE* fp = fdopen(fd, "rb");
+    if (fp == NULL)
+    {
+        close(fd);
+        return FAILURE;
+    }
+#else
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return FAILURE;
+#endif
+    Status status = chip8_load_rom(hChip8, fp);
+    fclose(fp);
+    return status;
+}
+
+void chip8_set_rom_cache_size(int images)
+{
+    chip8_lock(&images_lock);
+    rom_cache_size = images > 0 ? images : 0;
+    chip8_trim_images();
+    chip8_unlock(&images_lock);
+}
+
+// Copies the whole machine, memory and settings included. The fork shares the rom's image and takes its own
+// copy of the pages and decoded instructions pSource wrote to, all from the pools once instances are recycled
+CHIP8 chip8_clone(CHIP8 hChip8)
+{
+    Chip8* pSource = (Chip8*)hChip8;
+    Chip8* pChip8 = chip8_alloc_instance();
+    if (pChip8 == NULL)
+        return NULL;
+    memcpy(pChip8, pSource, sizeof(Chip8));
+
+    // Starts from the image alone so a fork that runs out of memory below can be destroyed like any instance
+    for (int page = 0; page < MEMORY_PAGES; page++)
+        pChip8->pages[page] = pSource->image->memory[page];
+    pChip8->private_pages = 0;
+    pChip8->decoded = pSource->image->decoded;
+    pChip8->jit = NULL;
+    pChip8->profile = NULL; // Forks start out unprofiled
+    chip8_retain_image(pSource->image);
+
+    Status status = SUCCESS;
+    for (int page = 0; status == SUCCESS && page < MEMORY_PAGES; page++)
+    {
+        if (!(pSource->private_pages & (1u << page)))
+            continue;
+        unsigned char* pPage = chip8_alloc_page();
+        if (pPage == NULL)
         {
-            case 0x0000: // 8XY0 - Sets VX to the value of XY
-                pChip8->V[(pChip8->opcode & 0x0F00) >> 8] = pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                pChip8->pc += 2;
-                break;
-            case 0x0001: // 8XY1 - Sets VX to VX or VY (bitwise OR operation)
-                pChip8->V[(pChip8->opcode & 0x0F00) >> 8] |= pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                pChip8->V[0xF] = 0;
-                pChip8->pc += 2;
-                break;
-            case 0x0002: // 8XY2 - Sets VX to VX and VY (bitwise AND operation)
-                pChip8->V[(pChip8->opcode & 0x0F00) >> 8] &= pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                pChip8->V[0xF] = 0;
-                pChip8->pc += 2;
-                break;
-            case 0x0003: // 8XY3 - Sets VX to VX xor VY (bitwise XOR operation)
-                pChip8->V[(pChip8->opcode & 0x0F00) >> 8] ^= pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                pChip8->V[0xF] = 0;
-                pChip8->pc += 2;
-                break;
-            case 0x0004: // 8XY4 - Adds VY to VX, VF is set to 1 when there's a carry, and to 0 when there is not
-                if (pChip8->V[(pChip8->opcode & 0x0F00) >> 8] + pChip8->V[(pChip8->opcode & 0x00F0) >> 4] > 0xFF)
-                {
-                    pChip8->V[(pChip8->opcode & 0x0F00) >> 8] += pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                    pChip8->V[0xF] = 1;
-                }
-                else
-                {
-                    pChip8->V[(pChip8->opcode & 0x0F00) >> 8] += pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                    pChip8->V[0xF] = 0;
-                }
-                pChip8->pc += 2;
-                break;
-            case 0x0005: // 8XY5 - VY is subtracted from VX, VF is set to 0 when there's a borrow, and 1 when there is not
-                if (pChip8->V[(pChip8->opcode & 0x0F00) >> 8] - pChip8->V[(pChip8->opcode & 0x00F0) >> 4] < 0x00)
-                {
-                    pChip8->V[(pChip8->opcode & 0x0F00) >> 8] -= pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                    pChip8->V[0xF] = 0;
-                }
-                else
-                {
-                    pChip8->V[(pChip8->opcode & 0x0F00) >> 8] -= pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-                    pChip8->V[0xF] = 1; 
-                }
-                pChip8->pc += 2;
-                break;
-            case 0x0006: // 8XY6 - Stores the least significant bit of VX in VF and then shifts VX to the right by 1
-                pChip8->V[0xF] = pChip8->V[(pChip8->opcode & 0x0F00) >> 8] & 0x1;
-                pChip8->V[(pChip8->opcode & 0x0F00) >> 8] >>= 1;
-                pChip8->pc += 2;
-                break;
-            case 0x0007: // 8XY7 - Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there is not
-                pChip8->V[(pChip8->opcode & 0x0F00) >> 8] = pChip8->V[(pChip8->opcode & 0x00F0) >> 4] - pChip8->V[(pChip8->opcode & 0x0F00) >> 8];
-                if (pChip8->V[(pChip8->opcode & 0x0F00) >> 8] > pChip8->V[(pChip8->opcode & 0x00F0) >> 4])
-                    pChip8->V[0xF] = 0;
-                else 
-                    pChip8->V[0xF] = 1;
-                pChip8->pc += 2;
-                break;
-            case 0x000E: // 8XYE - Stores the most significant bit of VX in VF and then shifts VX to the left by 1
-                pChip8->V[0xF] = pChip8->V[(pChip8->opcode & 0x0F00) >> 8] >> 0x7;
-                pChip8->V[(pChip8->opcode & 0x0F00) >> 8] <<= 1;
-                pChip8->pc += 2;
-                break;
-            default:
-                printf("Unknown Opcode [0x8000]: 0x%x\n", pChip8->opcode);
+            status = FAILURE;
+            break;
         }
-        break;
-    case 0x9000: // 9XY0 - Skips the next instruction if VX does not equal VY (usually the next instruction is a jump to skip a code block)
-        if ((pChip8->V[(pChip8->opcode & 0x0F00) >> 8]) != (pChip8->V[(pChip8->opcode & 0x00F0) >> 4]))
-            pChip8->pc += 4;
-        else
-            pChip8->pc += 2;
-        break;
-    case 0xA000: // ANNN - Sets I to the address NNN
-        pChip8->I = pChip8->opcode & 0x0FFF;
-        pChip8->pc += 2;
-        break;
-    case 0xB000: // BNNN - Jumps to the address NNN plus V0
-        pChip8->pc = (pChip8->opcode & 0x0FFF) + pChip8->V[0x0];
-        break; 
-    case 0xC000: // CXNN - Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN
-        pChip8->V[(pChip8->opcode & 0x0F00) >> 8] = (rand() % (255 + 1 - 0) + 0) & (pChip8->opcode & 0x00FF);
-        pChip8->pc += 2;
-        break;
-    case 0xD000: // DXYN - Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels
-                 // Each row of 8 pixels is read as bit-coded starting from memory location I; I value does not change after the execution of this instruction 
-                 // VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that does not happen
+        memcpy(pPage, pSource->pages[page], MEMORY_PAGE_SIZE);
+        pChip8->pages[page] = pPage;
+        pChip8->private_pages |= 1u << page;
+    }
+    if (status == SUCCESS && pSource->decoded != pSource->image->decoded)
+    {
+        Instruction* decoded = chip8_alloc_decoded();
+        if (decoded != NULL)
         {
-            unsigned char x = pChip8->V[(pChip8->opcode & 0x0F00) >> 8];
-            unsigned char y = pChip8->V[(pChip8->opcode & 0x00F0) >> 4];
-            unsigned char height = pChip8->opcode & 0x000F;
-            unsigned char current_row;
+            memcpy(decoded, pSource->decoded, sizeof(pSource->image->decoded));
+            pChip8->decoded = decoded;
+        }
+        else
+            status = FAILURE;
+    }
+    // Compiled blocks belong to one instance, the fork compiles its own as it runs
+    if (status == SUCCESS && pSource->jit != NULL && (pChip8->jit = chip8_jit_create()) == NULL)
+        status = FAILURE;
 
-            pChip8->V[0xF] = 0;
-            for (int current_y = 0; current_y < height; current_y++)
-            {
-                current_row = pChip8->memory[pChip8->I + current_y];
-                for (int current_x = 0; current_x < 8; current_x++)
-                {
-                    if ((current_row & (0x80 >> current_x)) != 0)
-                    { 
-                        if (pChip8->gfx[x + current_x + ((y + current_y) * SCREEN_WIDTH)] == 1)
-                            pChip8->V[0xF] = 1;
-                        pChip8->gfx[x + current_x + ((y + current_y) * SCREEN_WIDTH)] ^= 1;
-                    }
-                }   
-            }
+    if (status == FAILURE)
+        chip8_destory((CHIP8*)&pChip8);
+    return pChip8;
+}
 
-            pChip8->draw_flag = TRUE;
-            pChip8->pc += 2;
-        } 
-        break;
-    case 0xE000:
-        switch(pChip8->opcode & 0x00FF)
+// Back to the state the loaded rom starts in, keeping the core, speed and reporting settings
+void chip8_reset(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    int cycles_per_tick = pChip8->cycles_per_tick;
+    memset(pChip8, 0, CHIP8_REGISTER_BYTES);
+    pChip8->pc = 0x200;
+    pChip8->cycles_per_tick = cycles_per_tick;
+    // Same first tick as a new instance given the same speed with chip8_set_ips
+    pChip8->tick_cycles_left = cycles_per_tick < CYCLES_PER_FRAME ? cycles_per_tick : CYCLES_PER_FRAME;
+    chip8_seed(pChip8, 0);
+
+    pChip8->frame_cycles_left = -1;
+    pChip8->key_event_head = 0;
+    pChip8->key_event_count = 0;
+    pChip8->frame_sequence = 0;
+    pChip8->unknown_opcodes = 0;
+    pChip8->dirty_rows = 0;
+    memset(pChip8->pixels, 0, sizeof(pChip8->pixels));
+
+    // Drops every page and instruction the instance copied, the image keeps the reference it had
+    chip8_retain_image(pChip8->image);
+    chip8_attach_image(pChip8, pChip8->image);
+}
+
+// Switch based interpreter, runs up to cycles instructions and returns how many were executed
+// Stops early after an instruction that raised an event, a cycle where FX0A is still waiting counts as executed
+int chip8_interpret(Chip8* pChip8, int cycles)
+{
+    for (int executed = 0; executed < cycles; executed++)
+    {
+        // Fetch and decode the opcode, only done the first time an address is executed
+        Instruction* pInstruction = chip8_fetch(pChip8, pChip8->pc);
+        // Execute Opcode
+        if (!chip8_execute(pChip8, pInstruction))
         {
-        case 0x009E: // EX9E - Skips the next instruction if the key stored in VX is pressed (usually the next instruction is a jump to skip a code block)
-            if (pChip8->key[pChip8->V[(pChip8->opcode & 0x0F00) >> 8]] != 0)
-                pChip8->pc += 4;
-            else
-                pChip8->pc += 2;
-            break;
-        case 0x00A1: // EXA1 - Skips the next instruction if the key stored in VX is not pressed (usually the next instruction is a jump to skip a code block)
-            if (pChip8->key[pChip8->V[(pChip8->opcode & 0x0F00) >> 8]] == 0)
-                pChip8->pc += 4;
-            else
-                pChip8->pc += 2;
-            break;
-        default:
-            printf("Unknown Opcode [0xE000]: 0x%x\n", pChip8->opcode);
+            chip8_update_timers(pChip8);
+            return executed + 1;
         }
-        break;
-    case 0xF000:
-        switch (pChip8->opcode & 0x00FF)
+
+        // Update timers
+        chip8_update_timers(pChip8);
+        if (pChip8->events)
+            return executed + 1;
+    }
+    return cycles;
+}
+
+void chip8_emulate_cycle(CHIP8 hChip8)
+{
+    chip8_run_cycles(hChip8, 1, NULL);
+}
+
+// Applies the pending key events that are due and returns how many cycles can run before the next one
+static int chip8_apply_key_events(Chip8* pChip8, int budget)
+{
+    while (pChip8->key_event_count > 0)
+    {
+        KeyEvent* pEvent = &pChip8->key_events[pChip8->key_event_head];
+        if (pEvent->cycle > pChip8->cycles)
+            return pEvent->cycle - pChip8->cycles < (uint64_t)budget ? (int)(pEvent->cycle - pChip8->cycles) : budget;
+        pChip8->key[pEvent->key] = pEvent->state;
+        pChip8->key_event_head = (pChip8->key_event_head + 1) % KEY_EVENT_CAPACITY;
+        pChip8->key_event_count--;
+    }
+    return budget;
+}
+
+RunStatus chip8_run_cycles(CHIP8 hChip8, int cycles, int* executed)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    int done = 0;
+    Boolean idle = FALSE;
+
+    pChip8->events = 0;
+    while (done < cycles && !pChip8->events)
+    {
+        // Batches stop at the next key event so it lands on exactly the cycle it was queued for
+        int budget = chip8_apply_key_events(pChip8, cycles - done);
+#ifdef CHIP8_ENABLE_PROFILE
+        if (pChip8->profile != NULL)
+            done += chip8_profile_run(pChip8, budget);
+        else
+#endif
+        switch (pChip8->core)
         {
-        case 0x0007: // FX07 - Sets VX to the value of the delay timer
-            pChip8->V[(pChip8->opcode & 0x0F00) >> 8] = pChip8->delay_timer;
-            pChip8->pc += 2;
-            break;
-        case 0x000A: // FX0A - A key press is awaited, and then stored in VX (blocking operation, all instruction halted until next key event)
+        case CORE_JIT:
+            // The JIT runs whole compiled blocks and falls back to the interpreter for anything it cannot translate
             {
-                Boolean key_pressed = FALSE;
-                for (int i = 0; i < NUM_OF_KEYS; i++)
-                {
-                    if (pChip8->key[i] == 1)
-                    {
-                        key_pressed = TRUE;
-                        pChip8->V[(pChip8->opcode & 0x0F00) >> 8] = i;
-                    }
-                }
-                if (!key_pressed)
-                    return;
-                pChip8->pc += 2;
+                int block = chip8_jit_run(pChip8, budget);
+                done += block > 0 ? block : chip8_interpret(pChip8, 1);
             }
             break;
-        case 0x0015: // FX15 - Sets the delay timer to VX
-            pChip8->delay_timer = pChip8->V[(pChip8->opcode & 0x0F00) >> 8];
-            pChip8->pc += 2;
-            break;
-        case 0x0018: // FX18 - Sets the sound timer to VX
-            pChip8->sound_timer = pChip8->V[(pChip8->opcode & 0x0F00) >> 8];
-            pChip8->pc += 2;
-            break;
-        case 0x001E: // FX1E - Adds VX to I. VF is not affected
-            pChip8->I += pChip8->V[(pChip8->opcode & 0x0F00) >> 8];
-            pChip8->pc += 2;
-            break;
-        case 0x0029: // FX29 - Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font
-            pChip8->I = pChip8->V[(pChip8->opcode & 0x0F00) >> 8] * 0x5;
-            pChip8->pc += 2;
-            break;
-        case 0x0033: // FX33 - Stores the binary-coded decimal representation of VX, with the hundreds digit in
-                     // memory at location in I, the tens digit at location I+1, and the ones digit at location I+2
-            pChip8->memory[pChip8->I] = pChip8->V[(pChip8->opcode & 0x0F00) >> 8] / 100;
-            pChip8->memory[(pChip8->I) + 1] = (pChip8->V[(pChip8->opcode & 0x0F00) >> 8] / 10) % 10;
-            pChip8->memory[(pChip8->I) + 2] = (pChip8->V[(pChip8->opcode & 0x0F00) >> 8] % 100) % 10;
-            pChip8->pc += 2;
-            break;
-        case 0x0055: // FX55 - Stores from V0 to VX (including VX) in memory, starting at address I
-                     // The offset from I is increased by 1 for each value written, but I itself is left unmodified
-            {
-                int offset = (pChip8->opcode & 0x0F00) >> 8;
-                for (int i = 0; i <= offset; i++)
-                    pChip8->memory[pChip8->I + i] = pChip8->V[i];
-                pChip8->pc += 2;
-            }
-            break;
-        case 0x0065:; // Fills from V0 to VX (including VX) with values from memory, starting at address I
-                     // The offset from I is increased by 1 for each value read, but I itself is left unmodified
-            {
-                int offset = (pChip8->opcode & 0x0F00) >> 8;
-                for (int i = 0; i <= offset; i++)
-                    pChip8->V[i] = pChip8->memory[pChip8->I + i];
-                pChip8->pc += 2;
-            }
+        case CORE_THREADED:
+            done += chip8_threaded_run(pChip8, budget);
             break;
         default:
-            printf("Unknown Opcode [0xF000]: 0x%x\n", pChip8->opcode);
+            done += chip8_interpret(pChip8, budget);
+        }
+
+        if (pChip8->events == EVENT_IDLE)
+        {
+            // Only an idle loop stopped the core, skip the spinning up to the next key event and carry on
+            pChip8->events = 0;
+#ifdef CHIP8_ENABLE_PROFILE
+            int tick_cycles_left = pChip8->tick_cycles_left;
+#endif
+            int skipped = chip8_fast_forward(pChip8, chip8_apply_key_events(pChip8, cycles - done));
+#ifdef CHIP8_ENABLE_PROFILE
+            if (pChip8->profile != NULL)
+                chip8_profile_skip(pChip8, tick_cycles_left, skipped);
+#endif
+            done += skipped;
+            idle = skipped > 0 && done == cycles;
         }
-        break;
-    default:
-        printf("Unknown Opcode 0x%X\n", pChip8->opcode);
     }
 
-    // Update timers
-    if (pChip8->delay_timer > 0)
-        pChip8->delay_timer--;
-    if (pChip8->sound_timer > 0)
+    if (executed != NULL)
+        *executed = done;
+    if (pChip8->events & EVENT_WAIT_KEY)
+        return RUN_WAIT_KEY;
+    if (pChip8->events & EVENT_SOUND)
+        return RUN_SOUND;
+    if (pChip8->events & EVENT_DRAW)
+        return RUN_DRAW;
+    return idle ? RUN_IDLE : RUN_COMPLETE;
+}
+
+// Runs the rest of the current frame, returning early on events so the caller can handle them and call again
+// Returns RUN_COMPLETE or RUN_IDLE once the frame's instructions are used up, or RUN_WAIT_KEY when FX0A ends the frame early
+RunStatus chip8_run_frame(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    int executed;
+
+    if (pChip8->frame_cycles_left < 0)
+        pChip8->frame_cycles_left = pChip8->cycles_per_frame;
+    if (pChip8->frame_cycles_left == 0)
+    {
+        // The last call used up the frame but returned an event instead
+        pChip8->frame_cycles_left = -1;
+        return RUN_COMPLETE;
+    }
+
+    RunStatus status = chip8_run_cycles(hChip8, pChip8->frame_cycles_left, &executed);
+    pChip8->frame_cycles_left -= executed;
+    // FX0A spins for the rest of the frame, the clock keeps running so the timers stay at 60 Hz while it waits
+    if (status == RUN_WAIT_KEY)
+        chip8_advance_clock(pChip8, pChip8->frame_cycles_left);
+    if (status == RUN_COMPLETE || status == RUN_IDLE || status == RUN_WAIT_KEY)
+        pChip8->frame_cycles_left = -1;
+    return status;
+}
+
+void chip8_seed(CHIP8 hChip8, uint64_t seed)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    // splitmix64 spreads similar seeds (e.g. consecutive timestamps) over the whole state
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    pChip8->random = z != 0 ? z : 1;
+}
+
+void chip8_set_cycles_per_frame(CHIP8 hChip8, int cycles)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    pChip8->cycles_per_frame = cycles;
+}
+
+// Sets the emulated speed, the timers tick every ips / 60 cycles and a frame runs that many cycles
+// chip8_set_cycles_per_frame can raise the frame budget afterwards for turbo without changing guest timing
+void chip8_set_ips(CHIP8 hChip8, int ips)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    int cycles = ips / FRAME_RATE > 0 ? ips / FRAME_RATE : 1;
+    pChip8->cycles_per_tick = cycles;
+    pChip8->cycles_per_frame = cycles;
+    if (pChip8->tick_cycles_left > cycles)
+        pChip8->tick_cycles_left = cycles;
+}
+
+// Speed actually emulated, chip8_set_ips rounds to a whole number of cycles per timer tick
+int chip8_get_ips(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    return pChip8->cycles_per_tick * FRAME_RATE;
+}
+
+uint64_t chip8_get_cycles(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    return pChip8->cycles;
+}
+
+Status chip8_set_core(CHIP8 hChip8, Core core)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    if (core == CORE_THREADED && !chip8_threaded_available())
+        return FAILURE;
+    if (core == CORE_JIT && pChip8->jit == NULL)
     {
-        pChip8->sound_timer--;
+        pChip8->jit = chip8_jit_create();
+        if (pChip8->jit == NULL)
+            return FAILURE;
     }
+    pChip8->core = core;
+    return SUCCESS;
 }
 
 unsigned char* chip8_get_gfx(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    for (int r = 0; r < SCREEN_HEIGHT; r++)
+    {
+        for (int c = 0; c < SCREEN_WIDTH; c++)
+            pChip8->pixels[r * SCREEN_WIDTH + c] = (pChip8->gfx[r] >> (63 - c)) & 1;
+    }
+    return pChip8->pixels;
+}
+
+const uint64_t* chip8_get_gfx_packed(CHIP8 hChip8)
 {
     Chip8* pChip8 = (Chip8*)hChip8;
     return pChip8->gfx;
 }
 
-Boolean chip8_get_draw_flag(CHIP8 hChip8)
+uint32_t chip8_get_dirty_rows(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    return pChip8->dirty_rows;
+}
+
+void chip8_clear_dirty_rows(CHIP8 hChip8)
 {
     Chip8* pChip8 = (Chip8*)hChip8;
-    return pChip8->draw_flag;
+    pChip8->dirty_rows = 0;
+}
+
+uint64_t chip8_get_screen_hash(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    // FNV-1a over the packed rows a byte at a time, least significant byte first
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int r = 0; r < SCREEN_HEIGHT; r++)
+    {
+        for (int b = 0; b < 8; b++)
+            hash = (hash ^ ((pChip8->gfx[r] >> (8 * b)) & 0xFF)) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+unsigned int chip8_get_frame_sequence(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    return pChip8->frame_sequence;
 }
 
 int chip8_get_sound_timer(CHIP8 hChip8)
@@ -428,10 +984,12 @@ int chip8_get_sound_timer(CHIP8 hChip8)
     return pChip8->sound_timer;
 }
 
-void chip8_set_draw_flag(CHIP8 hChip8, Boolean value)
+int chip8_get_sound_cycles(CHIP8 hChip8)
 {
     Chip8* pChip8 = (Chip8*)hChip8;
-    pChip8->draw_flag = value;
+    if (pChip8->sound_timer == 0)
+        return 0;
+    return pChip8->tick_cycles_left + (pChip8->sound_timer - 1) * pChip8->cycles_per_tick;
 }
 
 void chip8_set_key(CHIP8 hChip8, int key_index, int state)
@@ -440,6 +998,66 @@ void chip8_set_key(CHIP8 hChip8, int key_index, int state)
     pChip8->key[key_index] = state;
 }
 
+// Queues a key change for when the cycle counter reaches cycle, events in the past apply before the next instruction
+// Events are kept in cycle order so one queued earlier than the last pending event is moved up to its cycle
+// FAILURE when key_index is not a CHIP8 key or the queue is full
+Status chip8_queue_key(CHIP8 hChip8, int key_index, int state, uint64_t cycle)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    if (key_index < 0 || key_index >= NUM_OF_KEYS || pChip8->key_event_count == KEY_EVENT_CAPACITY)
+        return FAILURE;
+    if (pChip8->key_event_count > 0)
+    {
+        KeyEvent* pLast = &pChip8->key_events[(pChip8->key_event_head + pChip8->key_event_count - 1) % KEY_EVENT_CAPACITY];
+        if (cycle < pLast->cycle)
+            cycle = pLast->cycle;
+    }
+    KeyEvent* pEvent = &pChip8->key_events[(pChip8->key_event_head + pChip8->key_event_count) % KEY_EVENT_CAPACITY];
+    pEvent->cycle = cycle;
+    pEvent->key = key_index;
+    pEvent->state = state;
+    pChip8->key_event_count++;
+    return SUCCESS;
+}
+
+static int chip8_count_private_pages(Chip8* pChip8)
+{
+    int pages = 0;
+    for (unsigned int bits = pChip8->private_pages; bits != 0; bits &= bits - 1)
+        pages++;
+    return pages;
+}
+
+size_t chip8_get_private_bytes(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    size_t bytes = sizeof(Chip8) + chip8_count_private_pages(pChip8) * MEMORY_PAGE_SIZE;
+    if (pChip8->decoded != pChip8->image->decoded)
+        bytes += sizeof(pChip8->image->decoded);
+    return bytes;
+}
+
+size_t chip8_get_shared_bytes(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    size_t bytes = (MEMORY_PAGES - chip8_count_private_pages(pChip8)) * MEMORY_PAGE_SIZE;
+    if (pChip8->decoded == pChip8->image->decoded)
+        bytes += sizeof(pChip8->image->decoded);
+    return bytes;
+}
+
+uint64_t chip8_get_unknown_opcodes(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    return pChip8->unknown_opcodes;
+}
+
+void chip8_set_report_unknown(CHIP8 hChip8, Boolean report)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    pChip8->report_unknown = report;
+}
+
 void chip8_debug(CHIP8 hChip8, Boolean* enabled)
 {
     Chip8* pChip8 = (Chip8*)hChip8;
@@ -449,7 +1067,7 @@ void chip8_debug(CHIP8 hChip8, Boolean* enabled)
     Boolean done = FALSE;
     
     printf("----------------------------------------------------------\n");
-    printf("Next Opcode: 0x%x\n", (pChip8->memory[pChip8->pc] << 8 | pChip8->memory[pChip8->pc + 1]) & 0xFFFF);
+    printf("Next Opcode: 0x%x\n", (chip8_read(pChip8, pChip8->pc) << 8 | chip8_read(pChip8, pChip8->pc + 1)) & 0xFFFF);
     printf("I = 0x%x\n", pChip8->I);
     printf("PC = 0x%x\n", pChip8->pc);
     printf("SP = %d\n", pChip8->sp);
@@ -474,7 +1092,7 @@ void chip8_debug(CHIP8 hChip8, Boolean* enabled)
             printf("Memory:\n");
             for (int i = 0; i < MEMORY_SIZE; i++)
             {
-                printf("0x%x ", pChip8->memory[i]);
+                printf("0x%x ", chip8_read(pChip8, i));
                 if (i % 32 == 0 && i != 0)
                     printf("\n");
             }
@@ -494,7 +1112,7 @@ void chip8_debug(CHIP8 hChip8, Boolean* enabled)
             {
                 for (int c = 0; c < SCREEN_WIDTH; c++)
                 {
-                    printf("%d ", pChip8->gfx[r * SCREEN_WIDTH + c]);
+                    printf("%d ", (int)((pChip8->gfx[r] >> (63 - c)) & 1));
                 }
                 printf("\n");
             }
@@ -552,11 +1170,18 @@ void chip8_debug(CHIP8 hChip8, Boolean* enabled)
 void chip8_destory(CHIP8* phChip8)
 {
     Chip8* pChip8 = (Chip8*)*phChip8;
-    free(pChip8->key);
-    free(pChip8->stack);
-    free(pChip8->gfx);
-    free(pChip8->V);
-    free(pChip8->memory);
-    free(pChip8);
+    if (pChip8->jit != NULL)
+        chip8_jit_destroy(&pChip8->jit);
+    if (pChip8->profile != NULL)
+        chip8_profile_destroy(&pChip8->profile);
+    for (int page = 0; page < MEMORY_PAGES; page++)
+    {
+        if (pChip8->private_pages & (1u << page))
+            chip8_free_page(pChip8->pages[page]);
+    }
+    if (pChip8->decoded != pChip8->image->decoded)
+        chip8_free_decoded(pChip8->decoded);
+    chip8_release_image(pChip8->image);
+    chip8_free_instance(pChip8);
     *phChip8 = NULL;
-}
\ No newline at end of file
+}
@@ -1,6 +1,10 @@
-#ifndef chip8_H
+#ifndef CHIP8_H
 #define CHIP8_H
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
 // System Parameters
 #define SCREEN_WIDTH 64
 #define SCREEN_HEIGHT 32
@@ -8,6 +12,8 @@
 #define CPU_REGISTERS 16
 #define STACK_SIZE 16
 #define NUM_OF_KEYS 16
+#define FRAME_RATE 60
+#define CYCLES_PER_FRAME 10
 
 typedef void* CHIP8;
 
@@ -15,15 +21,83 @@ typedef void* CHIP8;
 typedef enum status {FAILURE, SUCCESS} Status;
 typedef enum boolean {FALSE, TRUE} Boolean;
 
+// CPU Cores, CORE_JIT is only available in x86-64 builds configured with CHIP8_JIT
+// and CORE_THREADED needs a compiler with labels as values (GCC or Clang)
+typedef enum core {CORE_INTERPRETER, CORE_JIT, CORE_THREADED} Core;
+
+// Why chip8_run_cycles or chip8_run_frame returned, RUN_COMPLETE means the whole budget was executed
+// and RUN_IDLE means the end of it was skipped because the program was spinning in an idle loop
+// RUN_SOUND is returned right after FX18 writes the sound timer so the tone can start or stop on that cycle
+typedef enum run_status {RUN_COMPLETE, RUN_DRAW, RUN_SOUND, RUN_WAIT_KEY, RUN_IDLE} RunStatus;
+
 // Chip8 Opaque Object Functions
 CHIP8 chip8_init_default(void);
+// Roms are read up to the end of the stream, so pipes and stdin work as well as files
 Status chip8_load_rom(CHIP8 hChip8, FILE* fp);
+Status chip8_load_rom_memory(CHIP8 hChip8, const void* rom, size_t size);
+// Reads the file at path, or stdin when path is "-"
+Status chip8_load_rom_file(CHIP8 hChip8, const char* path);
+// Instances loading the same rom share one copy of it, and up to images of them (64 by default) are kept
+// once no instance uses them so loading them again costs a hash of the rom
+void chip8_set_rom_cache_size(int images);
+// Forks a running instance, NULL when out of memory. Instances come from a pool so forking and destroying
+// thousands of them a second is a copy of the state and the pages it wrote to
+CHIP8 chip8_clone(CHIP8 hChip8);
+// Restarts the loaded rom in place, the core, speed and settings are kept and CXNN is seeded with 0 again
+void chip8_reset(CHIP8 hChip8);
+// Seeds the random numbers of CXNN, instances start seeded with 0
+void chip8_seed(CHIP8 hChip8, uint64_t seed);
 void chip8_emulate_cycle(CHIP8 hChip8);
+RunStatus chip8_run_cycles(CHIP8 hChip8, int cycles, int* executed);
+RunStatus chip8_run_frame(CHIP8 hChip8);
+void chip8_set_cycles_per_frame(CHIP8 hChip8, int cycles);
+void chip8_set_ips(CHIP8 hChip8, int ips);
+int chip8_get_ips(CHIP8 hChip8);
+uint64_t chip8_get_cycles(CHIP8 hChip8);
+Status chip8_set_core(CHIP8 hChip8, Core core);
 unsigned char* chip8_get_gfx(CHIP8 hChip8);
-Boolean chip8_get_draw_flag(CHIP8 hChip8);
+// One 64 bit word per row, the most significant bit is the leftmost pixel
+const uint64_t* chip8_get_gfx_packed(CHIP8 hChip8);
+// Bit r is set when row r was drawn to since the last clear, a row can be dirty and still hold what it started with
+uint32_t chip8_get_dirty_rows(CHIP8 hChip8);
+void chip8_clear_dirty_rows(CHIP8 hChip8);
+// Same for the same screen on every build and platform
+uint64_t chip8_get_screen_hash(CHIP8 hChip8);
+// Counts every draw, the screen changed when it differs from the last value seen
+unsigned int chip8_get_frame_sequence(CHIP8 hChip8);
 int chip8_get_sound_timer(CHIP8 hChip8);
-void chip8_set_draw_flag(CHIP8 hChip8, Boolean value);
+// Cycles until the sound timer reaches zero, 0 when it is silent
+int chip8_get_sound_cycles(CHIP8 hChip8);
 void chip8_set_key(CHIP8 hChip8, int key_index, int state);
+Status chip8_queue_key(CHIP8 hChip8, int key_index, int state, uint64_t cycle);
+// Save states (chip8_state.c), buffers need chip8_state_size bytes
+size_t chip8_state_size(void);
+Status chip8_save_state(CHIP8 hChip8, void* buffer, size_t size, Boolean checksum);
+Status chip8_load_state(CHIP8 hChip8, const void* buffer, size_t size);
+// Hash of the whole machine state, two runs ended in the same state when their hashes match
+uint32_t chip8_get_state_hash(CHIP8 hChip8);
+// TRUE when two instances are in exactly the same state, for telling states with the same hash apart
+Boolean chip8_same_state(CHIP8 hFirst, CHIP8 hSecond);
+// Bytes held by this instance alone, itself and the memory pages and decoded instructions it copied to write to them
+size_t chip8_get_private_bytes(CHIP8 hChip8);
+// Bytes of memory and decoded instructions it shares with every other instance that loaded the same rom
+size_t chip8_get_shared_bytes(CHIP8 hChip8);
+// Counts instructions per opcode and per address and sprites drawn per frame, for builds configured with
+// -DCHIP8_PROFILE=ON, FAILURE in other builds. A profiled instance runs on the interpreter whatever its core
+// and turning profiling off drops the counts
+Status chip8_set_profiling(CHIP8 hChip8, Boolean enabled);
+// Writes the counts so far as CSV or JSON, FAILURE when profiling is off
+Status chip8_write_profile(CHIP8 hChip8, FILE* fp, Boolean csv);
+// Writes the counts to path, as CSV when it ends in .csv and as JSON otherwise
+Status chip8_write_profile_file(CHIP8 hChip8, const char* path);
+// Samples the guest call stack every interval cycles, 1 samples every cycle and 0 stops. Turns profiling on
+Status chip8_set_stack_sampling(CHIP8 hChip8, int interval);
+// Writes the sampled stacks in the folded format flamegraph.pl and speedscope read. Routines are named after
+// labels, lines of "address name", when labels is not NULL and sub_NNN otherwise
+Status chip8_write_stacks(CHIP8 hChip8, FILE* fp, FILE* labels);
+// Unknown opcodes executed so far, each one is also printed unless reporting is turned off
+uint64_t chip8_get_unknown_opcodes(CHIP8 hChip8);
+void chip8_set_report_unknown(CHIP8 hChip8, Boolean report);
 void chip8_debug(CHIP8 hChip8, Boolean* enabled);
 void chip8_destory(CHIP8* phChip8);
 
@@ -0,0 +1,201 @@
+#ifndef CHIP8_INTERNAL_H
+#define CHIP8_INTERNAL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "chip8.h"
+
+// Private state shared by the interpreter and the alternate CPU cores, not part of the public API
+
+// Instruction handlers, named after the opcode they execute
+typedef enum op
+{
+    OP_UNDECODED,
+    OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_6XNN, OP_7XNN,
+    OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+    OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E, OP_EXA1,
+    OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX33, OP_FX55, OP_FX65,
+    OP_IDLE, // 1NNN that closes an idle loop, see chip8_decode_at
+    OP_UNKNOWN
+} Op;
+
+// Predecoded instruction, one per memory address so each opcode is only decoded once
+typedef struct instruction
+{
+    unsigned char op;
+    unsigned char x;
+    unsigned char y;
+    unsigned char n;
+    unsigned char nn;
+    unsigned short nnn;
+} Instruction;
+
+typedef struct jit Jit;
+typedef struct profile Profile;
+
+// Memory is split into pages, instances running the same rom share its pages until they write to them
+#define MEMORY_PAGE_SHIFT 8
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
+
+// Font and rom loaded into memory, read only and shared by every instance that loaded the same bytes
+// Every instruction is decoded when the image is built so the cores never decode into a shared image
+typedef struct image
+{
+    struct image* next;  // Next image in the same hash bucket, loading a rom again finds its image there
+    struct image* older; // Neighbours in the cache of images no instance uses, oldest first
+    struct image* newer;
+    int references;
+    uint32_t hash;
+    unsigned char memory[MEMORY_PAGES][MEMORY_PAGE_SIZE];
+    Instruction decoded[MEMORY_SIZE];
+} Image;
+
+// Key change applied when the cycle counter reaches cycle
+typedef struct key_event
+{
+    uint64_t cycle;
+    unsigned char key;
+    unsigned char state;
+} KeyEvent;
+
+#define KEY_EVENT_CAPACITY 64
+
+// Events raised by opcodes that make the run loops return early
+#define EVENT_DRAW 0x1
+#define EVENT_SOUND 0x2
+#define EVENT_WAIT_KEY 0x4
+#define EVENT_IDLE 0x8 // Handled by chip8_run_cycles, which skips the idle loop and carries on
+
+// Core new instances start with, builds can default to the threaded core with -DCHIP8_DEFAULT_CORE=CORE_THREADED
+#ifndef CHIP8_DEFAULT_CORE
+#define CHIP8_DEFAULT_CORE CORE_INTERPRETER
+#endif
+
+// Instances are allocated on a cache line boundary, CHIP8_ALIGNED aligns members inside them
+#define CACHE_LINE_SIZE 64
+#ifdef _MSC_VER
+#define CHIP8_ALIGNED(n) __declspec(align(n))
+#else
+#define CHIP8_ALIGNED(n) __attribute__((aligned(n)))
+#endif
+
+// The whole instance is one aligned block, the architectural state apart from memory comes first and is
+// contiguous up to the end of gfx, everything after it is memory, configuration or derived from that state
+typedef struct chip8
+{
+    // Hot CPU state, fits in the first two cache lines ahead of gfx
+    unsigned short pc;
+    unsigned short I;
+    unsigned short sp;
+    unsigned short opcode;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned char events;
+    unsigned char V[CPU_REGISTERS];
+    unsigned short stack[STACK_SIZE];
+    unsigned char key[NUM_OF_KEYS];
+    uint64_t cycles;      // Guest instructions executed since the instance was created
+    int tick_cycles_left; // Cycles until the timers next count down
+    int cycles_per_tick;  // Cycles per 60 Hz timer tick
+    uint64_t random;      // xorshift64* state for CXNN, never zero
+    CHIP8_ALIGNED(CACHE_LINE_SIZE) uint64_t gfx[SCREEN_HEIGHT]; // One word per row, bit 63 is x = 0
+
+    // Memory pages and decoded instructions are the image's until the instance writes to them
+    Instruction* decoded;      // The image's until a write changes memory, then a copy of it
+    unsigned char* pages[MEMORY_PAGES];
+    unsigned int private_pages; // Bit p is set when pages[p] is a copy that belongs to this instance
+    Image* image;
+
+    int cycles_per_frame;
+    int frame_cycles_left; // Negative when the next chip8_run_frame starts a new frame
+    Core core;
+    Jit* jit;
+    Profile* profile; // Counters kept while chip8_set_profiling is on, NULL otherwise
+    KeyEvent key_events[KEY_EVENT_CAPACITY]; // Pending key changes in cycle order, a ring starting at key_event_head
+    int key_event_head;
+    int key_event_count;
+    unsigned int frame_sequence; // Incremented by every 00E0 and DXYN
+    uint64_t unknown_opcodes;    // Unknown opcodes executed
+    Boolean report_unknown;      // Print every unknown opcode executed
+    uint32_t dirty_rows; // Bit r is set when DXYN or 00E0 changed row r since chip8_clear_dirty_rows
+    unsigned char pixels[SCREEN_WIDTH * SCREEN_HEIGHT]; // Byte per pixel copy of gfx for chip8_get_gfx
+} Chip8;
+
+// Save states are a copy of the architectural state, everything from the start of Chip8 to the end of gfx
+// followed by memory
+#define CHIP8_REGISTER_BYTES offsetof(Chip8, decoded)
+#define CHIP8_STATE_BYTES (CHIP8_REGISTER_BYTES + MEMORY_SIZE)
+
+// Opcode to Op table shared by every instance
+extern unsigned char chip8_handlers[0x10000];
+
+void chip8_decode(unsigned short opcode, Instruction* pInstruction);
+void chip8_decode_at(Chip8* pChip8, unsigned short address);
+void chip8_invalidate(Chip8* pChip8, int address, int length);
+int chip8_interpret(Chip8* pChip8, int cycles);
+// Copies a shared page for the instance to write to, returns it or NULL when out of memory
+unsigned char* chip8_own_page(Chip8* pChip8, int page);
+// Replaces a page with bytes, sharing the image's page again when they match it
+void chip8_set_page(Chip8* pChip8, int page, const unsigned char* bytes);
+// Makes pChip8 run the rom pSource has loaded
+void chip8_share_rom(Chip8* pChip8, Chip8* pSource);
+
+// Addresses wrap at MEMORY_SIZE
+static inline unsigned char chip8_read(const Chip8* pChip8, int address)
+{
+    return pChip8->pages[(address >> MEMORY_PAGE_SHIFT) & (MEMORY_PAGES - 1)][address & (MEMORY_PAGE_SIZE - 1)];
+}
+
+// Writes are followed by chip8_invalidate over the written range
+static inline void chip8_write(Chip8* pChip8, int address, unsigned char value)
+{
+    int page = (address >> MEMORY_PAGE_SHIFT) & (MEMORY_PAGES - 1);
+    unsigned char* pPage = pChip8->private_pages & (1u << page) ? pChip8->pages[page] : chip8_own_page(pChip8, page);
+    if (pPage != NULL)
+        pPage[address & (MEMORY_PAGE_SIZE - 1)] = value;
+}
+
+// Returns the predecoded instruction at address, decoding it first if needed. BNNN and skips can take pc past
+// the end of memory, it wraps like every other address
+static inline Instruction* chip8_fetch(Chip8* pChip8, unsigned short address)
+{
+    address &= MEMORY_SIZE - 1;
+    Instruction* pInstruction = &pChip8->decoded[address];
+    if (pInstruction->op == OP_UNDECODED)
+        chip8_decode_at(pChip8, address);
+    return pInstruction;
+}
+
+// Advances the cycle counter, the timers count down every cycles_per_tick cycles so they run at 60 Hz of guest time
+// however fast the host executes
+static inline void chip8_advance_clock(Chip8* pChip8, int cycles)
+{
+    pChip8->cycles += cycles;
+    pChip8->tick_cycles_left -= cycles;
+    while (pChip8->tick_cycles_left <= 0)
+    {
+        pChip8->tick_cycles_left += pChip8->cycles_per_tick;
+        if (pChip8->delay_timer > 0)
+            pChip8->delay_timer--;
+        if (pChip8->sound_timer > 0)
+            pChip8->sound_timer--;
+    }
+}
+
+// Direct threaded interpreter (chip8_threaded.c)
+Boolean chip8_threaded_available(void);
+int chip8_threaded_run(Chip8* pChip8, int cycles);
+
+// x86-64 basic block recompiler (chip8_jit.c)
+Jit* chip8_jit_create(void);
+int chip8_jit_run(Chip8* pChip8, int cycles);
+void chip8_jit_invalidate(Jit* pJit, int address, int length);
+void chip8_jit_destroy(Jit** ppJit);
+
+// Opcode profiler (chip8_profile.c), counts instructions while running them on the interpreter
+int chip8_profile_run(Chip8* pChip8, int cycles);
+void chip8_profile_skip(Chip8* pChip8, int tick_cycles_left, int skipped);
+void chip8_profile_destroy(Profile** ppProfile);
+
+#endif
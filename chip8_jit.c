@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "chip8.h"
+#include "chip8_internal.h"
+
+// Basic block recompiler for x86-64
+// A block starts at pc and runs until a control flow opcode (1NNN, 2NNN, 00EE, BNNN or a skip) or until an opcode
+// the recompiler does not translate (draws, memory stores, timers, keys...), which is then left to the interpreter
+// Compiled blocks only touch registers, I, pc and the stack, so they never read the timers and never write memory
+
+#if defined(CHIP8_ENABLE_JIT) && (defined(__x86_64__) || defined(_M_X64))
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define CODE_SIZE (1024 * 1024)
+#define MAX_BLOCK_SIZE 4096 // Worst case machine code for one block, a flush happens when less than this is left
+#define MAX_BLOCK_INSTRUCTIONS 64
+#define CODE_PAGE_SIZE 256
+
+// x86-64 register numbers, only volatile registers are used so blocks need no prologue on either calling convention
+#define RAX 0
+#define RCX 1
+#define RDX 2  // Chip8*
+#define R8 8   // V
+#define R9 9   // stack
+
+// Condition codes for jcc/setcc
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+
+typedef int (*BlockFunction)(Chip8* pChip8);
+
+typedef struct block
+{
+    BlockFunction function;      // NULL when not compiled
+    unsigned short end;          // First address after the block
+    unsigned short instructions; // Guest instructions executed by one run of the block
+} Block;
+
+struct jit
+{
+    unsigned char* code;
+    int code_used;
+    Block blocks[MEMORY_SIZE];
+    unsigned char code_pages[MEMORY_SIZE / CODE_PAGE_SIZE]; // Set when a compiled block covers the page
+};
+
+static void emit8(Jit* pJit, int value)
+{
+    pJit->code[pJit->code_used++] = (unsigned char)value;
+}
+
+static void emit16(Jit* pJit, int value)
+{
+    emit8(pJit, value & 0xFF);
+    emit8(pJit, (value >> 8) & 0xFF);
+}
+
+static void emit32(Jit* pJit, int value)
+{
+    emit16(pJit, value & 0xFFFF);
+    emit16(pJit, (value >> 16) & 0xFFFF);
+}
+
+// Emits opcode with a [base + disp32] memory operand, size selects the operand size prefixes (8, 16, 32 or 64)
+// Opcodes above 0xFF are two byte opcodes, reg is either a register or the /digit opcode extension
+static void emit_mem(Jit* pJit, int size, int opcode, int reg, int base, int offset)
+{
+    int rex = 0x40 | (size == 64 ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+    if (size == 16)
+        emit8(pJit, 0x66);
+    if (rex != 0x40)
+        emit8(pJit, rex);
+    if (opcode > 0xFF)
+        emit8(pJit, opcode >> 8);
+    emit8(pJit, opcode & 0xFF);
+    emit8(pJit, 0x80 | (reg & 7) << 3 | (base & 7));
+    emit32(pJit, offset);
+}
+
+// setcc cl
+static void emit_setcc_cl(Jit* pJit, int cc)
+{
+    emit8(pJit, 0x0F);
+    emit8(pJit, 0x90 | cc);
+    emit8(pJit, 0xC1);
+}
+
+// Sets pc and returns the number of guest instructions executed
+static void emit_exit(Jit* pJit, int pc, int instructions)
+{
+    emit_mem(pJit, 16, 0xC7, 0, RDX, offsetof(Chip8, pc));
+    emit16(pJit, pc);
+    emit8(pJit, 0xB8); // mov eax, imm32
+    emit32(pJit, instructions);
+    emit8(pJit, 0xC3); // ret
+}
+
+// Finishes a skip opcode whose flags are already set, cc_no_skip is the condition under which the next instruction runs
+static void emit_skip(Jit* pJit, int cc_no_skip, int address, int instructions)
+{
+    emit8(pJit, 0x70 | cc_no_skip);
+    int patch = pJit->code_used;
+    emit8(pJit, 0);
+    emit_exit(pJit, address + 4, instructions);
+    pJit->code[patch] = (unsigned char)(pJit->code_used - patch - 1);
+    emit_exit(pJit, address + 2, instructions);
+}
+
+// Translates one instruction, returns TRUE when it ends the block
+static Boolean emit_instruction(Jit* pJit, Instruction* pInstruction, int address, int instructions)
+{
+    int x = pInstruction->x;
+    int y = pInstruction->y;
+    int I = offsetof(Chip8, I);
+    int sp = offsetof(Chip8, sp);
+
+    switch (pInstruction->op)
+    {
+    case OP_00EE:
+        emit_mem(pJit, 16, 0x83, 5, RDX, sp);  // sub word [sp], 1
+        emit8(pJit, 1);
+        emit_mem(pJit, 32, 0x0FB7, RCX, RDX, sp); // movzx ecx, word [sp]
+        emit8(pJit, 0x41); emit8(pJit, 0x0F); emit8(pJit, 0xB7); emit8(pJit, 0x04); emit8(pJit, 0x49); // movzx eax, word [r9 + rcx * 2]
+        emit8(pJit, 0x83); emit8(pJit, 0xC0); emit8(pJit, 0x02); // add eax, 2
+        emit_mem(pJit, 16, 0x89, RAX, RDX, offsetof(Chip8, pc));
+        emit8(pJit, 0xB8);
+        emit32(pJit, instructions);
+        emit8(pJit, 0xC3);
+        return TRUE;
+    case OP_1NNN:
+        emit_exit(pJit, pInstruction->nnn, instructions);
+        return TRUE;
+    case OP_2NNN:
+        emit_mem(pJit, 32, 0x0FB7, RCX, RDX, sp); // movzx ecx, word [sp]
+        emit8(pJit, 0x66); emit8(pJit, 0x41); emit8(pJit, 0xC7); emit8(pJit, 0x04); emit8(pJit, 0x49); // mov word [r9 + rcx * 2], address
+        emit16(pJit, address);
+        emit_mem(pJit, 16, 0x83, 0, RDX, sp);  // add word [sp], 1
+        emit8(pJit, 1);
+        emit_exit(pJit, pInstruction->nnn, instructions);
+        return TRUE;
+    case OP_3XNN:
+        emit_mem(pJit, 8, 0x80, 7, R8, x); // cmp byte [VX], NN
+        emit8(pJit, pInstruction->nn);
+        emit_skip(pJit, CC_NE, address, instructions);
+        return TRUE;
+    case OP_4XNN:
+        emit_mem(pJit, 8, 0x80, 7, R8, x);
+        emit8(pJit, pInstruction->nn);
+        emit_skip(pJit, CC_E, address, instructions);
+        return TRUE;
+    case OP_5XY0:
+        emit_mem(pJit, 8, 0x8A, RAX, R8, x); // mov al, [VX]
+        emit_mem(pJit, 8, 0x3A, RAX, R8, y); // cmp al, [VY]
+        emit_skip(pJit, CC_NE, address, instructions);
+        return TRUE;
+    case OP_9XY0:
+        emit_mem(pJit, 8, 0x8A, RAX, R8, x);
+        emit_mem(pJit, 8, 0x3A, RAX, R8, y);
+        emit_skip(pJit, CC_E, address, instructions);
+        return TRUE;
+    case OP_BNNN:
+        emit_mem(pJit, 32, 0x0FB6, RAX, R8, 0); // movzx eax, byte [V0]
+        emit8(pJit, 0x05);                      // add eax, NNN
+        emit32(pJit, pInstruction->nnn);
+        emit_mem(pJit, 16, 0x89, RAX, RDX, offsetof(Chip8, pc));
+        emit8(pJit, 0xB8);
+        emit32(pJit, instructions);
+        emit8(pJit, 0xC3);
+        return TRUE;
+    case OP_6XNN:
+        emit_mem(pJit, 8, 0xC6, 0, R8, x); // mov byte [VX], NN
+        emit8(pJit, pInstruction->nn);
+        return FALSE;
+    case OP_7XNN:
+        emit_mem(pJit, 8, 0x80, 0, R8, x); // add byte [VX], NN
+        emit8(pJit, pInstruction->nn);
+        return FALSE;
+    case OP_8XY0:
+        emit_mem(pJit, 8, 0x8A, RAX, R8, y);
+        emit_mem(pJit, 8, 0x88, RAX, R8, x);
+        return FALSE;
+    case OP_8XY1:
+    case OP_8XY2:
+    case OP_8XY3:
+        emit_mem(pJit, 8, 0x8A, RAX, R8, y);
+        emit_mem(pJit, 8, pInstruction->op == OP_8XY1 ? 0x08 : pInstruction->op == OP_8XY2 ? 0x20 : 0x30, RAX, R8, x); // or/and/xor [VX], al
+        emit_mem(pJit, 8, 0xC6, 0, R8, 0xF);
+        emit8(pJit, 0);
+        return FALSE;
+    case OP_8XY4:
+    case OP_8XY5:
+        emit_mem(pJit, 8, 0x8A, RAX, R8, x);
+        emit_mem(pJit, 8, pInstruction->op == OP_8XY4 ? 0x02 : 0x2A, RAX, R8, y); // add/sub al, [VY]
+        emit_setcc_cl(pJit, pInstruction->op == OP_8XY4 ? CC_B : CC_AE);
+        emit_mem(pJit, 8, 0x88, RAX, R8, x);
+        emit_mem(pJit, 8, 0x88, RCX, R8, 0xF);
+        return FALSE;
+    case OP_8XY6:
+        emit_mem(pJit, 8, 0x8A, RCX, R8, x);
+        emit8(pJit, 0x80); emit8(pJit, 0xE1); emit8(pJit, 0x01); // and cl, 1
+        emit_mem(pJit, 8, 0x88, RCX, R8, 0xF);
+        emit_mem(pJit, 8, 0xD0, 5, R8, x); // shr byte [VX], 1
+        return FALSE;
+    case OP_8XY7:
+        emit_mem(pJit, 8, 0x8A, RAX, R8, y);
+        emit_mem(pJit, 8, 0x2A, RAX, R8, x);
+        emit_mem(pJit, 8, 0x88, RAX, R8, x);
+        emit_mem(pJit, 8, 0x8A, RAX, R8, x);
+        emit_mem(pJit, 8, 0x3A, RAX, R8, y);
+        emit_setcc_cl(pJit, CC_BE);
+        emit_mem(pJit, 8, 0x88, RCX, R8, 0xF);
+        return FALSE;
+    case OP_8XYE:
+        emit_mem(pJit, 8, 0x8A, RCX, R8, x);
+        emit8(pJit, 0xC0); emit8(pJit, 0xE9); emit8(pJit, 0x07); // shr cl, 7
+        emit_mem(pJit, 8, 0x88, RCX, R8, 0xF);
+        emit_mem(pJit, 8, 0xD0, 4, R8, x); // shl byte [VX], 1
+        return FALSE;
+    case OP_ANNN:
+        emit_mem(pJit, 16, 0xC7, 0, RDX, I);
+        emit16(pJit, pInstruction->nnn);
+        return FALSE;
+    case OP_FX1E:
+        emit_mem(pJit, 32, 0x0FB6, RAX, R8, x);
+        emit_mem(pJit, 16, 0x01, RAX, RDX, I); // add word [I], ax
+        return FALSE;
+    case OP_FX29:
+        emit_mem(pJit, 32, 0x0FB6, RAX, R8, x);
+        emit8(pJit, 0x8D); emit8(pJit, 0x04); emit8(pJit, 0x80); // lea eax, [rax + rax * 4]
+        emit_mem(pJit, 16, 0x89, RAX, RDX, I);
+        return FALSE;
+    default:
+        return FALSE;
+    }
+}
+
+static Boolean is_translated(Op op)
+{
+    switch (op)
+    {
+    case OP_00EE: case OP_1NNN: case OP_2NNN: case OP_3XNN: case OP_4XNN: case OP_5XY0: case OP_9XY0: case OP_BNNN:
+    case OP_6XNN: case OP_7XNN: case OP_8XY0: case OP_8XY1: case OP_8XY2: case OP_8XY3: case OP_8XY4: case OP_8XY5:
+    case OP_8XY6: case OP_8XY7: case OP_8XYE: case OP_ANNN: case OP_FX1E: case OP_FX29:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static void jit_flush(Jit* pJit)
+{
+    for (int i = 0; i < MEMORY_SIZE; i++)
+        pJit->blocks[i].function = NULL;
+    for (int i = 0; i < MEMORY_SIZE / CODE_PAGE_SIZE; i++)
+        pJit->code_pages[i] = 0;
+    pJit->code_used = 0;
+}
+
+static Block* jit_compile(Chip8* pChip8, unsigned short start)
+{
+    Jit* pJit = pChip8->jit;
+    Block* pBlock = &pJit->blocks[start];
+    int address = start;
+    int instructions = 0;
+    Boolean done = FALSE;
+
+    if (start + 1 >= MEMORY_SIZE || !is_translated(chip8_fetch(pChip8, start)->op))
+        return NULL;
+    if (CODE_SIZE - pJit->code_used < MAX_BLOCK_SIZE)
+        jit_flush(pJit);
+
+    unsigned char* function = pJit->code + pJit->code_used;
+    // Move the first argument into rdx and point r8 and r9 at V and the stack inside it
+#ifdef _WIN32
+    emit8(pJit, 0x48); emit8(pJit, 0x89); emit8(pJit, 0xCA); // mov rdx, rcx
+#else
+    emit8(pJit, 0x48); emit8(pJit, 0x89); emit8(pJit, 0xFA); // mov rdx, rdi
+#endif
+    emit_mem(pJit, 64, 0x8D, R8, RDX, offsetof(Chip8, V));     // lea r8, [rdx + V]
+    emit_mem(pJit, 64, 0x8D, R9, RDX, offsetof(Chip8, stack)); // lea r9, [rdx + stack]
+
+    while (!done)
+    {
+        if (address + 1 >= MEMORY_SIZE || instructions == MAX_BLOCK_INSTRUCTIONS || !is_translated(chip8_fetch(pChip8, address)->op))
+        {
+            emit_exit(pJit, address, instructions);
+            break;
+        }
+        Instruction* pInstruction = chip8_fetch(pChip8, address);
+        instructions++;
+        done = emit_instruction(pJit, pInstruction, address, instructions);
+        address += 2;
+    }
+
+    pBlock->function = (BlockFunction)function;
+    pBlock->end = address;
+    pBlock->instructions = instructions;
+    for (int page = start / CODE_PAGE_SIZE; page <= (address - 1) / CODE_PAGE_SIZE; page++)
+        pJit->code_pages[page] = 1;
+    return pBlock;
+}
+
+Jit* chip8_jit_create(void)
+{
+    Jit* pJit = (Jit*)calloc(1, sizeof(Jit));
+    if (pJit == NULL)
+        return NULL;
+#ifdef _WIN32
+    pJit->code = (unsigned char*)VirtualAlloc(NULL, CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    pJit->code = (unsigned char*)mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pJit->code == MAP_FAILED)
+        pJit->code = NULL;
+#endif
+    if (pJit->code == NULL)
+    {
+        free(pJit);
+        return NULL;
+    }
+    return pJit;
+}
+
+// Runs the block at pc if it fits in cycles, returns 0 when the interpreter has to execute the next instruction
+int chip8_jit_run(Chip8* pChip8, int cycles)
+{
+    // BNNN and skips can leave pc past the end of memory, the interpreter runs from there until it is back
+    if (pChip8->pc >= MEMORY_SIZE)
+        return 0;
+    Block* pBlock = &pChip8->jit->blocks[pChip8->pc];
+    if (pBlock->function == NULL)
+    {
+        pBlock = jit_compile(pChip8, pChip8->pc);
+        if (pBlock == NULL)
+            return 0;
+    }
+    if (pBlock->instructions > cycles)
+        return 0;
+
+    int instructions = pBlock->function(pChip8);
+
+    // Blocks never read the timers so the clock can be caught up once for the whole block
+    chip8_advance_clock(pChip8, instructions);
+    return instructions;
+}
+
+void chip8_jit_invalidate(Jit* pJit, int address, int length)
+{
+    int first_page = address / CODE_PAGE_SIZE;
+    int last_page = (address + length - 1) / CODE_PAGE_SIZE;
+    Boolean has_code = FALSE;
+    for (int page = first_page; page <= last_page && page < MEMORY_SIZE / CODE_PAGE_SIZE; page++)
+        has_code |= pJit->code_pages[page];
+    if (!has_code)
+        return;
+
+    // Drop every block overlapping the write, their machine code is reclaimed on the next flush
+    for (int i = 0; i < MEMORY_SIZE; i++)
+    {
+        Block* pBlock = &pJit->blocks[i];
+        if (pBlock->function != NULL && i < address + length && pBlock->end > address)
+            pBlock->function = NULL;
+    }
+}
+
+void chip8_jit_destroy(Jit** ppJit)
+{
+    Jit* pJit = *ppJit;
+#ifdef _WIN32
+    VirtualFree(pJit->code, 0, MEM_RELEASE);
+#else
+    munmap(pJit->code, CODE_SIZE);
+#endif
+    free(pJit);
+    *ppJit = NULL;
+}
+
+#else
+
+// Recompiler not built, chip8_set_core(hChip8, CORE_JIT) fails and the interpreter keeps running
+
+Jit* chip8_jit_create(void)
+{
+    return NULL;
+}
+
+int chip8_jit_run(Chip8* pChip8, int cycles)
+{
+    return 0;
+}
+
+void chip8_jit_invalidate(Jit* pJit, int address, int length)
+{
+}
+
+void chip8_jit_destroy(Jit** ppJit)
+{
+    *ppJit = NULL;
+}
+
+#endif
@@ -0,0 +1,430 @@
+#ifndef CHIP8_OPS_H
+#define CHIP8_OPS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8_internal.h"
+
+// Opcode implementations shared by every interpreter core, each one executes a single decoded instruction
+// Opcodes from https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
+
+// 00E0 - Clears the Screen
+static inline void chip8_op_00E0(Chip8* pChip8, const Instruction* pInstruction)
+{
+    for (int r = 0; r < SCREEN_HEIGHT; r++)
+    {
+        if (pChip8->gfx[r] != 0)
+            pChip8->dirty_rows |= 1u << r;
+    }
+    memset(pChip8->gfx, 0, SCREEN_HEIGHT * sizeof(uint64_t));
+    pChip8->frame_sequence++;
+    pChip8->events |= EVENT_DRAW;
+    pChip8->pc += 2;
+}
+
+// 00EE - Returns from a Subroutine
+static inline void chip8_op_00EE(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->sp--;
+    pChip8->pc = pChip8->stack[pChip8->sp];
+    pChip8->pc += 2;
+}
+
+// 1NNN - Jumps to address NNN
+static inline void chip8_op_1NNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->pc = pInstruction->nnn;
+}
+
+// 1NNN decoded as OP_IDLE - Jumps like 1NNN and lets chip8_run_cycles fast-forward the loop it closes
+static inline void chip8_op_idle(Chip8* pChip8, const Instruction* pInstruction)
+{
+    chip8_op_1NNN(pChip8, pInstruction);
+    pChip8->events |= EVENT_IDLE;
+}
+
+// 2NNN - Calls subroutine at NNN
+static inline void chip8_op_2NNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->stack[pChip8->sp] = pChip8->pc;
+    pChip8->sp++;
+    pChip8->pc = pInstruction->nnn;
+}
+
+// 3XNN - Skips the next instruction if VX equals NN (usually the next instruction is a jump to skip a code block)
+static inline void chip8_op_3XNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->V[pInstruction->x] == pInstruction->nn)
+        pChip8->pc += 4;
+    else
+        pChip8->pc += 2;
+}
+
+// 4XNN - Skips the next instruction if VX does not equal NN (usually the next instruction is a jump to skip a code block)
+static inline void chip8_op_4XNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->V[pInstruction->x] != pInstruction->nn)
+        pChip8->pc += 4;
+    else
+        pChip8->pc += 2;
+}
+
+// 5XY0 - Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block)
+static inline void chip8_op_5XY0(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->V[pInstruction->x] == pChip8->V[pInstruction->y])
+        pChip8->pc += 4;
+    else
+        pChip8->pc += 2;
+}
+
+// 6XNN - Sets VX to NN
+static inline void chip8_op_6XNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] = pInstruction->nn;
+    pChip8->pc += 2;
+}
+
+// 7XNN - Adds NN to VX (carry flag is not changed)
+static inline void chip8_op_7XNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] += pInstruction->nn;
+    pChip8->pc += 2;
+}
+
+// 8XY0 - Sets VX to the value of XY
+static inline void chip8_op_8XY0(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] = pChip8->V[pInstruction->y];
+    pChip8->pc += 2;
+}
+
+// 8XY1 - Sets VX to VX or VY (bitwise OR operation)
+static inline void chip8_op_8XY1(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] |= pChip8->V[pInstruction->y];
+    pChip8->V[0xF] = 0;
+    pChip8->pc += 2;
+}
+
+// 8XY2 - Sets VX to VX and VY (bitwise AND operation)
+static inline void chip8_op_8XY2(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] &= pChip8->V[pInstruction->y];
+    pChip8->V[0xF] = 0;
+    pChip8->pc += 2;
+}
+
+// 8XY3 - Sets VX to VX xor VY (bitwise XOR operation)
+static inline void chip8_op_8XY3(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] ^= pChip8->V[pInstruction->y];
+    pChip8->V[0xF] = 0;
+    pChip8->pc += 2;
+}
+
+// 8XY4 - Adds VY to VX, VF is set to 1 when there's a carry, and to 0 when there is not
+static inline void chip8_op_8XY4(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->V[pInstruction->x] + pChip8->V[pInstruction->y] > 0xFF)
+    {
+        pChip8->V[pInstruction->x] += pChip8->V[pInstruction->y];
+        pChip8->V[0xF] = 1;
+    }
+    else
+    {
+        pChip8->V[pInstruction->x] += pChip8->V[pInstruction->y];
+        pChip8->V[0xF] = 0;
+    }
+    pChip8->pc += 2;
+}
+
+// 8XY5 - VY is subtracted from VX, VF is set to 0 when there's a borrow, and 1 when there is not
+static inline void chip8_op_8XY5(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->V[pInstruction->x] - pChip8->V[pInstruction->y] < 0x00)
+    {
+        pChip8->V[pInstruction->x] -= pChip8->V[pInstruction->y];
+        pChip8->V[0xF] = 0;
+    }
+    else
+    {
+        pChip8->V[pInstruction->x] -= pChip8->V[pInstruction->y];
+        pChip8->V[0xF] = 1;
+    }
+    pChip8->pc += 2;
+}
+
+// 8XY6 - Stores the least significant bit of VX in VF and then shifts VX to the right by 1
+static inline void chip8_op_8XY6(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[0xF] = pChip8->V[pInstruction->x] & 0x1;
+    pChip8->V[pInstruction->x] >>= 1;
+    pChip8->pc += 2;
+}
+
+// 8XY7 - Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there is not
+static inline void chip8_op_8XY7(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] = pChip8->V[pInstruction->y] - pChip8->V[pInstruction->x];
+    if (pChip8->V[pInstruction->x] > pChip8->V[pInstruction->y])
+        pChip8->V[0xF] = 0;
+    else
+        pChip8->V[0xF] = 1;
+    pChip8->pc += 2;
+}
+
+// 8XYE - Stores the most significant bit of VX in VF and then shifts VX to the left by 1
+static inline void chip8_op_8XYE(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[0xF] = pChip8->V[pInstruction->x] >> 0x7;
+    pChip8->V[pInstruction->x] <<= 1;
+    pChip8->pc += 2;
+}
+
+// 9XY0 - Skips the next instruction if VX does not equal VY (usually the next instruction is a jump to skip a code block)
+static inline void chip8_op_9XY0(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->V[pInstruction->x] != pChip8->V[pInstruction->y])
+        pChip8->pc += 4;
+    else
+        pChip8->pc += 2;
+}
+
+// ANNN - Sets I to the address NNN
+static inline void chip8_op_ANNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->I = pInstruction->nnn;
+    pChip8->pc += 2;
+}
+
+// BNNN - Jumps to the address NNN plus V0
+static inline void chip8_op_BNNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->pc = pInstruction->nnn + pChip8->V[0x0];
+}
+
+// xorshift64*, the generator is part of the instance so the same seed and input always give the same run
+static inline unsigned char chip8_random(Chip8* pChip8)
+{
+    uint64_t x = pChip8->random;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    pChip8->random = x;
+    return (unsigned char)((x * 0x2545F4914F6CDD1DULL) >> 56);
+}
+
+// CXNN - Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN
+static inline void chip8_op_CXNN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] = chip8_random(pChip8) & pInstruction->nn;
+    pChip8->pc += 2;
+}
+
+// DXYN - Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels
+// Each row of 8 pixels is read as bit-coded starting from memory location I; I value does not change after the execution of this instruction
+// VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that does not happen
+// The start coordinates wrap around the screen, pixels that go past the right or bottom edge are clipped
+static inline void chip8_op_DXYN(Chip8* pChip8, const Instruction* pInstruction)
+{
+    unsigned char x = pChip8->V[pInstruction->x] % SCREEN_WIDTH;
+    unsigned char y = pChip8->V[pInstruction->y] % SCREEN_HEIGHT;
+    unsigned char height = pInstruction->n;
+    uint64_t collision = 0;
+
+    if (height > SCREEN_HEIGHT - y)
+        height = SCREEN_HEIGHT - y;
+    for (int current_y = 0; current_y < height; current_y++)
+    {
+        // Move the 8 pixel row to the top of the word then shift it across to x in one go
+        uint64_t sprite = (uint64_t)chip8_read(pChip8, pChip8->I + current_y) << 56 >> x;
+        collision |= pChip8->gfx[y + current_y] & sprite;
+        pChip8->gfx[y + current_y] ^= sprite;
+        if (sprite != 0)
+            pChip8->dirty_rows |= 1u << (y + current_y);
+    }
+    pChip8->V[0xF] = collision != 0;
+
+    pChip8->frame_sequence++;
+    pChip8->events |= EVENT_DRAW;
+    pChip8->pc += 2;
+}
+
+// EX9E - Skips the next instruction if the key stored in VX is pressed (usually the next instruction is a jump to skip a code block)
+static inline void chip8_op_EX9E(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->key[pChip8->V[pInstruction->x]] != 0)
+        pChip8->pc += 4;
+    else
+        pChip8->pc += 2;
+}
+
+// EXA1 - Skips the next instruction if the key stored in VX is not pressed (usually the next instruction is a jump to skip a code block)
+static inline void chip8_op_EXA1(Chip8* pChip8, const Instruction* pInstruction)
+{
+    if (pChip8->key[pChip8->V[pInstruction->x]] == 0)
+        pChip8->pc += 4;
+    else
+        pChip8->pc += 2;
+}
+
+// FX07 - Sets VX to the value of the delay timer
+static inline void chip8_op_FX07(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->V[pInstruction->x] = pChip8->delay_timer;
+    pChip8->pc += 2;
+}
+
+// FX0A - A key press is awaited, and then stored in VX (blocking operation, all instruction halted until next key event)
+// Returns FALSE while still waiting, the cores still count a waiting cycle and update the timers for it
+static inline Boolean chip8_op_FX0A(Chip8* pChip8, const Instruction* pInstruction)
+{
+    Boolean key_pressed = FALSE;
+    for (int i = 0; i < NUM_OF_KEYS; i++)
+    {
+        if (pChip8->key[i] == 1)
+        {
+            key_pressed = TRUE;
+            pChip8->V[pInstruction->x] = i;
+        }
+    }
+    if (!key_pressed)
+    {
+        pChip8->events |= EVENT_WAIT_KEY;
+        return FALSE;
+    }
+    pChip8->pc += 2;
+    return TRUE;
+}
+
+// FX15 - Sets the delay timer to VX
+static inline void chip8_op_FX15(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->delay_timer = pChip8->V[pInstruction->x];
+    pChip8->pc += 2;
+}
+
+// FX18 - Sets the sound timer to VX
+static inline void chip8_op_FX18(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->events |= EVENT_SOUND; // The tone can start, stop or change length here
+    pChip8->sound_timer = pChip8->V[pInstruction->x];
+    pChip8->pc += 2;
+}
+
+// FX1E - Adds VX to I. VF is not affected
+static inline void chip8_op_FX1E(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->I += pChip8->V[pInstruction->x];
+    pChip8->pc += 2;
+}
+
+// FX29 - Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font
+static inline void chip8_op_FX29(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->I = pChip8->V[pInstruction->x] * 0x5;
+    pChip8->pc += 2;
+}
+
+// FX33 - Stores the binary-coded decimal representation of VX, with the hundreds digit in
+// memory at location in I, the tens digit at location I+1, and the ones digit at location I+2
+static inline void chip8_op_FX33(Chip8* pChip8, const Instruction* pInstruction)
+{
+    chip8_write(pChip8, pChip8->I, pChip8->V[pInstruction->x] / 100);
+    chip8_write(pChip8, pChip8->I + 1, (pChip8->V[pInstruction->x] / 10) % 10);
+    chip8_write(pChip8, pChip8->I + 2, (pChip8->V[pInstruction->x] % 100) % 10);
+    chip8_invalidate(pChip8, pChip8->I, 3);
+    pChip8->pc += 2;
+}
+
+// FX55 - Stores from V0 to VX (including VX) in memory, starting at address I
+// The offset from I is increased by 1 for each value written, but I itself is left unmodified
+static inline void chip8_op_FX55(Chip8* pChip8, const Instruction* pInstruction)
+{
+    int offset = pInstruction->x;
+    for (int i = 0; i <= offset; i++)
+        chip8_write(pChip8, pChip8->I + i, pChip8->V[i]);
+    chip8_invalidate(pChip8, pChip8->I, offset + 1);
+    pChip8->pc += 2;
+}
+
+// FX65 - Fills from V0 to VX (including VX) with values from memory, starting at address I
+// The offset from I is increased by 1 for each value read, but I itself is left unmodified
+static inline void chip8_op_FX65(Chip8* pChip8, const Instruction* pInstruction)
+{
+    int offset = pInstruction->x;
+    for (int i = 0; i <= offset; i++)
+        pChip8->V[i] = chip8_read(pChip8, pChip8->I + i);
+    pChip8->pc += 2;
+}
+
+static inline void chip8_op_unknown(Chip8* pChip8, const Instruction* pInstruction)
+{
+    pChip8->opcode = chip8_read(pChip8, pChip8->pc) << 8 | chip8_read(pChip8, pChip8->pc + 1);
+    pChip8->unknown_opcodes++;
+    if (pChip8->report_unknown)
+        printf("Unknown Opcode [0x%04x]: 0x%x\n", pChip8->opcode & 0xF000, pChip8->opcode);
+}
+
+// Executes one decoded instruction without counting its cycle, returns FALSE while FX0A is still waiting for a key
+static inline Boolean chip8_execute(Chip8* pChip8, const Instruction* pInstruction)
+{
+    switch (pInstruction->op)
+    {
+    case OP_00E0: chip8_op_00E0(pChip8, pInstruction); break;
+    case OP_00EE: chip8_op_00EE(pChip8, pInstruction); break;
+    case OP_1NNN: chip8_op_1NNN(pChip8, pInstruction); break;
+    case OP_IDLE: chip8_op_idle(pChip8, pInstruction); break;
+    case OP_2NNN: chip8_op_2NNN(pChip8, pInstruction); break;
+    case OP_3XNN: chip8_op_3XNN(pChip8, pInstruction); break;
+    case OP_4XNN: chip8_op_4XNN(pChip8, pInstruction); break;
+    case OP_5XY0: chip8_op_5XY0(pChip8, pInstruction); break;
+    case OP_6XNN: chip8_op_6XNN(pChip8, pInstruction); break;
+    case OP_7XNN: chip8_op_7XNN(pChip8, pInstruction); break;
+    case OP_8XY0: chip8_op_8XY0(pChip8, pInstruction); break;
+    case OP_8XY1: chip8_op_8XY1(pChip8, pInstruction); break;
+    case OP_8XY2: chip8_op_8XY2(pChip8, pInstruction); break;
+    case OP_8XY3: chip8_op_8XY3(pChip8, pInstruction); break;
+    case OP_8XY4: chip8_op_8XY4(pChip8, pInstruction); break;
+    case OP_8XY5: chip8_op_8XY5(pChip8, pInstruction); break;
+    case OP_8XY6: chip8_op_8XY6(pChip8, pInstruction); break;
+    case OP_8XY7: chip8_op_8XY7(pChip8, pInstruction); break;
+    case OP_8XYE: chip8_op_8XYE(pChip8, pInstruction); break;
+    case OP_9XY0: chip8_op_9XY0(pChip8, pInstruction); break;
+    case OP_ANNN: chip8_op_ANNN(pChip8, pInstruction); break;
+    case OP_BNNN: chip8_op_BNNN(pChip8, pInstruction); break;
+    case OP_CXNN: chip8_op_CXNN(pChip8, pInstruction); break;
+    case OP_DXYN: chip8_op_DXYN(pChip8, pInstruction); break;
+    case OP_EX9E: chip8_op_EX9E(pChip8, pInstruction); break;
+    case OP_EXA1: chip8_op_EXA1(pChip8, pInstruction); break;
+    case OP_FX07: chip8_op_FX07(pChip8, pInstruction); break;
+    case OP_FX0A: return chip8_op_FX0A(pChip8, pInstruction);
+    case OP_FX15: chip8_op_FX15(pChip8, pInstruction); break;
+    case OP_FX18: chip8_op_FX18(pChip8, pInstruction); break;
+    case OP_FX1E: chip8_op_FX1E(pChip8, pInstruction); break;
+    case OP_FX29: chip8_op_FX29(pChip8, pInstruction); break;
+    case OP_FX33: chip8_op_FX33(pChip8, pInstruction); break;
+    case OP_FX55: chip8_op_FX55(pChip8, pInstruction); break;
+    case OP_FX65: chip8_op_FX65(pChip8, pInstruction); break;
+    default: chip8_op_unknown(pChip8, pInstruction);
+    }
+    return TRUE;
+}
+
+// Counts one executed cycle, the single cycle version of chip8_advance_clock
+static inline void chip8_update_timers(Chip8* pChip8)
+{
+    pChip8->cycles++;
+    if (--pChip8->tick_cycles_left == 0)
+    {
+        pChip8->tick_cycles_left = pChip8->cycles_per_tick;
+        if (pChip8->delay_timer > 0)
+            pChip8->delay_timer--;
+        if (pChip8->sound_timer > 0)
+            pChip8->sound_timer--;
+    }
+}
+
+#endif
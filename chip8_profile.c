@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "chip8_internal.h"
+#include "chip8_ops.h"
+
+// Opcode profiler, counts the instructions executed per opcode class and per address and the sprites drawn
+// in every 60 Hz frame. Profiled instances run on a copy of the interpreter loop with the counting added, so
+// the cores themselves never look at the profiler
+// It can also sample the guest call stack every few cycles. The stack only holds the addresses of the 2NNN
+// that made each call, so the routine a frame is in is read back from the call instruction when sampling
+
+#ifdef CHIP8_ENABLE_PROFILE
+
+#define DRAW_BUCKETS 64 // Frames are counted by how many sprites they drew, the last bucket holds that many or more
+#define CALLER_CHANGED 0x8000 // Set on a frame whose call instruction was overwritten, the rest is the call's address
+
+// Samples taken with one call stack, frames[0] is the outermost call
+typedef struct stack_entry
+{
+    uint64_t samples;
+    uint32_t hash;
+    Boolean used;
+    unsigned short depth;
+    unsigned short frames[STACK_SIZE];
+} StackEntry;
+
+struct profile
+{
+    uint64_t ops[OP_UNKNOWN + 1];      // Instructions executed per Op
+    uint64_t addresses[MEMORY_SIZE];   // Instructions executed starting at each address
+    uint64_t cycles;                   // Cycles run while profiling, skipped ones included
+    uint64_t idle_skipped;             // Cycles of idle loops skipped without running them
+    uint64_t frames;                   // Timer ticks while profiling
+    uint64_t draw_frames[DRAW_BUCKETS];
+    unsigned int frame_draws;          // DXYN executed since the last tick
+    unsigned int max_frame_draws;
+
+    // Call stack sampling, off while stack_interval is 0
+    int stack_interval;            // Cycles between samples
+    int stack_countdown;           // Cycles until the next sample
+    StackEntry* stacks;            // Open addressing on hash
+    int stack_capacity;
+    int stack_count;
+    StackEntry* current_stack;     // Entry of the stack running now, NULL after a call or return
+    uint64_t dropped_samples;      // Samples lost when the table could not grow
+};
+
+static const char* op_names[OP_UNKNOWN + 1] =
+{
+    "UNDECODED",
+    "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+    "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+    "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65",
+    "IDLE",
+    "UNKNOWN"
+};
+
+static void chip8_profile_end_frame(Profile* pProfile)
+{
+    pProfile->frames++;
+    pProfile->draw_frames[pProfile->frame_draws < DRAW_BUCKETS ? pProfile->frame_draws : DRAW_BUCKETS - 1]++;
+    if (pProfile->frame_draws > pProfile->max_frame_draws)
+        pProfile->max_frame_draws = pProfile->frame_draws;
+    pProfile->frame_draws = 0;
+}
+
+static Status chip8_profile_grow_stacks(Profile* pProfile)
+{
+    int capacity = pProfile->stack_capacity != 0 ? pProfile->stack_capacity * 2 : 256;
+    StackEntry* stacks = (StackEntry*)calloc(capacity, sizeof(StackEntry));
+    if (stacks == NULL)
+        return FAILURE;
+    for (int i = 0; i < pProfile->stack_capacity; i++)
+    {
+        const StackEntry* pEntry = &pProfile->stacks[i];
+        if (!pEntry->used)
+            continue;
+        int slot = pEntry->hash & (capacity - 1);
+        while (stacks[slot].used)
+            slot = (slot + 1) & (capacity - 1);
+        stacks[slot] = *pEntry;
+    }
+    free(pProfile->stacks);
+    pProfile->stacks = stacks;
+    pProfile->stack_capacity = capacity;
+    pProfile->current_stack = NULL;
+    return SUCCESS;
+}
+
+// Finds or adds the entry for the call stack pChip8 is running with
+static StackEntry* chip8_profile_find_stack(Chip8* pChip8, Profile* pProfile)
+{
+    StackEntry key;
+    memset(&key, 0, sizeof(key));
+    // A stack that underflowed wraps sp around, it is cut to what the stack holds
+    key.depth = pChip8->sp < STACK_SIZE ? pChip8->sp : STACK_SIZE;
+    key.hash = 2166136261u;
+    for (int i = 0; i < key.depth; i++)
+    {
+        int call = pChip8->stack[i] & (MEMORY_SIZE - 1);
+        unsigned short opcode = chip8_read(pChip8, call) << 8 | chip8_read(pChip8, call + 1);
+        key.frames[i] = (opcode & 0xF000) == 0x2000 ? opcode & 0x0FFF : CALLER_CHANGED | call;
+        key.hash = (key.hash ^ key.frames[i]) * 16777619u;
+    }
+    key.hash = (key.hash ^ key.depth) * 16777619u;
+    key.used = TRUE;
+
+    if (2 * (pProfile->stack_count + 1) > pProfile->stack_capacity && chip8_profile_grow_stacks(pProfile) == FAILURE)
+        return NULL;
+    int slot = key.hash & (pProfile->stack_capacity - 1);
+    for (;;)
+    {
+        StackEntry* pEntry = &pProfile->stacks[slot];
+        if (!pEntry->used)
+        {
+            *pEntry = key;
+            pProfile->stack_count++;
+            return pEntry;
+        }
+        if (pEntry->hash == key.hash && pEntry->depth == key.depth &&
+            !memcmp(pEntry->frames, key.frames, key.depth * sizeof(unsigned short)))
+            return pEntry;
+        slot = (slot + 1) & (pProfile->stack_capacity - 1);
+    }
+}
+
+static void chip8_profile_sample(Chip8* pChip8, Profile* pProfile, uint64_t samples)
+{
+    if (pProfile->current_stack == NULL)
+        pProfile->current_stack = chip8_profile_find_stack(pChip8, pProfile);
+    if (pProfile->current_stack != NULL)
+        pProfile->current_stack->samples += samples;
+    else
+        pProfile->dropped_samples += samples;
+}
+
+// Same as chip8_interpret, counting every instruction before it executes
+int chip8_profile_run(Chip8* pChip8, int cycles)
+{
+    Profile* pProfile = pChip8->profile;
+    // The stack may have been loaded or reset since the last run
+    pProfile->current_stack = NULL;
+    for (int executed = 0; executed < cycles; executed++)
+    {
+        Instruction* pInstruction = chip8_fetch(pChip8, pChip8->pc);
+        pProfile->addresses[pChip8->pc & (MEMORY_SIZE - 1)]++;
+        pProfile->ops[pInstruction->op]++;
+        pProfile->cycles++;
+        if (pInstruction->op == OP_DXYN)
+            pProfile->frame_draws++;
+        if (pProfile->stack_interval != 0 && --pProfile->stack_countdown == 0)
+        {
+            pProfile->stack_countdown = pProfile->stack_interval;
+            chip8_profile_sample(pChip8, pProfile, 1);
+        }
+
+        Boolean completed = chip8_execute(pChip8, pInstruction);
+        if (pInstruction->op == OP_2NNN || pInstruction->op == OP_00EE)
+            pProfile->current_stack = NULL;
+        chip8_update_timers(pChip8);
+        if (pChip8->tick_cycles_left == pChip8->cycles_per_tick)
+            chip8_profile_end_frame(pProfile);
+        if (!completed || pChip8->events)
+            return executed + 1;
+    }
+    return cycles;
+}
+
+// Counts the cycles chip8_fast_forward skipped, tick_cycles_left is what it was before the skip
+void chip8_profile_skip(Chip8* pChip8, int tick_cycles_left, int skipped)
+{
+    Profile* pProfile = pChip8->profile;
+    pProfile->cycles += skipped;
+    pProfile->idle_skipped += skipped;
+    if (skipped >= tick_cycles_left)
+    {
+        uint64_t ticks = 1 + (skipped - tick_cycles_left) / pChip8->cycles_per_tick;
+        chip8_profile_end_frame(pProfile);
+        // Nothing is drawn in the frames after the first one, the loop only spins
+        pProfile->frames += ticks - 1;
+        pProfile->draw_frames[0] += ticks - 1;
+    }
+    // The idle loop runs with the stack it has now, it gets the samples that fell in the skipped cycles
+    if (pProfile->stack_interval != 0)
+    {
+        if (skipped >= pProfile->stack_countdown)
+        {
+            int past = skipped - pProfile->stack_countdown;
+            chip8_profile_sample(pChip8, pProfile, 1 + past / pProfile->stack_interval);
+            pProfile->stack_countdown = pProfile->stack_interval - past % pProfile->stack_interval;
+        }
+        else
+            pProfile->stack_countdown -= skipped;
+    }
+}
+
+// Does nothing when there is no profile, like free
+void chip8_profile_destroy(Profile** ppProfile)
+{
+    if (*ppProfile == NULL)
+        return;
+    free((*ppProfile)->stacks);
+    free(*ppProfile);
+    *ppProfile = NULL;
+}
+
+Status chip8_set_profiling(CHIP8 hChip8, Boolean enabled)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    if (!enabled)
+    {
+        chip8_profile_destroy(&pChip8->profile);
+        return SUCCESS;
+    }
+    if (pChip8->profile == NULL)
+        pChip8->profile = (Profile*)calloc(1, sizeof(Profile));
+    return pChip8->profile != NULL ? SUCCESS : FAILURE;
+}
+
+// CSV rows are kind,key,count so one file holds every table, JSON has a member per table and only lists the
+// addresses that executed anything
+Status chip8_write_profile(CHIP8 hChip8, FILE* fp, Boolean csv)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    const Profile* pProfile = pChip8->profile;
+    if (pProfile == NULL)
+        return FAILURE;
+
+    if (csv)
+    {
+        fprintf(fp, "kind,key,count\n");
+        fprintf(fp, "total,cycles,%llu\n", (unsigned long long)pProfile->cycles);
+        fprintf(fp, "total,idle_skipped,%llu\n", (unsigned long long)pProfile->idle_skipped);
+        fprintf(fp, "total,frames,%llu\n", (unsigned long long)pProfile->frames);
+        fprintf(fp, "total,draws,%llu\n", (unsigned long long)pProfile->ops[OP_DXYN]);
+        fprintf(fp, "total,max_frame_draws,%u\n", pProfile->max_frame_draws);
+        for (int op = OP_00E0; op <= OP_UNKNOWN; op++)
+            fprintf(fp, "op,%s,%llu\n", op_names[op], (unsigned long long)pProfile->ops[op]);
+        for (int address = 0; address < MEMORY_SIZE; address++)
+        {
+            if (pProfile->addresses[address] != 0)
+                fprintf(fp, "address,0x%03X,%llu\n", address, (unsigned long long)pProfile->addresses[address]);
+        }
+        for (int draws = 0; draws < DRAW_BUCKETS; draws++)
+        {
+            if (pProfile->draw_frames[draws] != 0)
+                fprintf(fp, "frame_draws,%d,%llu\n", draws, (unsigned long long)pProfile->draw_frames[draws]);
+        }
+    }
+    else
+    {
+        fprintf(fp, "{\"cycles\": %llu, \"idle_skipped\": %llu, \"frames\": %llu, \"draws\": %llu, \"max_frame_draws\": %u,\n",
+                (unsigned long long)pProfile->cycles, (unsigned long long)pProfile->idle_skipped,
+                (unsigned long long)pProfile->frames, (unsigned long long)pProfile->ops[OP_DXYN], pProfile->max_frame_draws);
+        fprintf(fp, " \"ops\": {");
+        for (int op = OP_00E0; op <= OP_UNKNOWN; op++)
+            fprintf(fp, "%s\"%s\": %llu", op == OP_00E0 ? "" : ", ", op_names[op], (unsigned long long)pProfile->ops[op]);
+        fprintf(fp, "},\n \"addresses\": {");
+        const char* separator = "";
+        for (int address = 0; address < MEMORY_SIZE; address++)
+        {
+            if (pProfile->addresses[address] == 0)
+                continue;
+            fprintf(fp, "%s\"0x%03X\": %llu", separator, address, (unsigned long long)pProfile->addresses[address]);
+            separator = ", ";
+        }
+        // Frames by sprites drawn, the last entry counts frames with that many or more
+        fprintf(fp, "},\n \"frame_draws\": [");
+        for (int draws = 0; draws < DRAW_BUCKETS; draws++)
+            fprintf(fp, "%s%llu", draws == 0 ? "" : ", ", (unsigned long long)pProfile->draw_frames[draws]);
+        fprintf(fp, "]}\n");
+    }
+    return ferror(fp) ? FAILURE : SUCCESS;
+}
+
+Status chip8_set_stack_sampling(CHIP8 hChip8, int interval)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    if (interval < 0 || (interval > 0 && chip8_set_profiling(hChip8, TRUE) == FAILURE))
+        return FAILURE;
+    if (pChip8->profile != NULL)
+    {
+        pChip8->profile->stack_interval = interval;
+        pChip8->profile->stack_countdown = interval;
+    }
+    return SUCCESS;
+}
+
+// Labels are lines of a hex address and a name, anything after a # is a comment
+static void chip8_read_labels(FILE* labels, char* names[MEMORY_SIZE])
+{
+    char line[256];
+    while (fgets(line, sizeof(line), labels) != NULL)
+    {
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+        char* end;
+        unsigned long address = strtoul(line, &end, 16);
+        char name[128];
+        if (end == line || address >= MEMORY_SIZE || sscanf(end, "%127s", name) != 1)
+            continue;
+        // Semicolons separate the frames of a folded stack
+        for (char* c = name; *c != '\0'; c++)
+        {
+            if (*c == ';')
+                *c = '_';
+        }
+        free(names[address]);
+        names[address] = (char*)malloc(strlen(name) + 1);
+        if (names[address] != NULL)
+            strcpy(names[address], name);
+    }
+}
+
+static void chip8_write_frame(FILE* fp, char* names[MEMORY_SIZE], unsigned short frame)
+{
+    if (frame & CALLER_CHANGED)
+        fprintf(fp, ";call_at_%03X", frame & (MEMORY_SIZE - 1));
+    else if (names[frame] != NULL)
+        fprintf(fp, ";%s", names[frame]);
+    else
+        fprintf(fp, ";sub_%03X", frame);
+}
+
+// Folded stacks, each line is the frames from the outermost one separated by semicolons and the samples taken
+// in that stack. Code that is not in any call is named after the label on the rom's first address or main
+Status chip8_write_stacks(CHIP8 hChip8, FILE* fp, FILE* labels)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    const Profile* pProfile = pChip8->profile;
+    if (pProfile == NULL)
+        return FAILURE;
+
+    char** names = (char**)calloc(MEMORY_SIZE, sizeof(char*));
+    if (names == NULL)
+        return FAILURE;
+    if (labels != NULL)
+        chip8_read_labels(labels, names);
+    const char* root = names[0x200] != NULL ? names[0x200] : "main";
+
+    for (int i = 0; i < pProfile->stack_capacity; i++)
+    {
+        const StackEntry* pEntry = &pProfile->stacks[i];
+        if (pEntry->samples == 0)
+            continue;
+        fprintf(fp, "%s", root);
+        for (int frame = 0; frame < pEntry->depth; frame++)
+            chip8_write_frame(fp, names, pEntry->frames[frame]);
+        fprintf(fp, " %llu\n", (unsigned long long)pEntry->samples);
+    }
+    if (pProfile->dropped_samples != 0)
+        fprintf(fp, "[dropped] %llu\n", (unsigned long long)pProfile->dropped_samples);
+
+    for (int address = 0; address < MEMORY_SIZE; address++)
+        free(names[address]);
+    free(names);
+    return ferror(fp) ? FAILURE : SUCCESS;
+}
+
+#else
+
+// Profiler not built, chip8_set_profiling(hChip8, TRUE) fails and nothing is counted
+
+int chip8_profile_run(Chip8* pChip8, int cycles)
+{
+    return chip8_interpret(pChip8, cycles);
+}
+
+void chip8_profile_skip(Chip8* pChip8, int tick_cycles_left, int skipped)
+{
+}
+
+void chip8_profile_destroy(Profile** ppProfile)
+{
+    *ppProfile = NULL;
+}
+
+Status chip8_set_profiling(CHIP8 hChip8, Boolean enabled)
+{
+    return enabled ? FAILURE : SUCCESS;
+}
+
+Status chip8_write_profile(CHIP8 hChip8, FILE* fp, Boolean csv)
+{
+    return FAILURE;
+}
+
+Status chip8_set_stack_sampling(CHIP8 hChip8, int interval)
+{
+    return interval == 0 ? SUCCESS : FAILURE;
+}
+
+Status chip8_write_stacks(CHIP8 hChip8, FILE* fp, FILE* labels)
+{
+    return FAILURE;
+}
+
+#endif
+
+Status chip8_write_profile_file(CHIP8 hChip8, const char* path)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    if (pChip8->profile == NULL)
+        return FAILURE;
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL)
+        return FAILURE;
+    size_t length = strlen(path);
+    Status status = chip8_write_profile(hChip8, fp, length >= 4 && !strcmp(path + length - 4, ".csv"));
+    if (fclose(fp) != 0)
+        status = FAILURE;
+    return status;
+}
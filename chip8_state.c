@@ -0,0 +1,175 @@
+#include <string.h>
+#include "chip8.h"
+#include "chip8_internal.h"
+
+// Save states, a small header followed by a straight copy of the architectural state and then memory
+// The copy includes struct padding and uses host byte order, the version and size reject states from other layouts
+
+#define STATE_MAGIC 0x54533843 // "C8ST"
+#define STATE_VERSION 1
+#define STATE_CHECKSUM 0x1
+
+typedef struct state_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t size;     // Bytes of state after the header
+    uint32_t checksum; // 0 unless STATE_CHECKSUM is set
+} StateHeader;
+
+// FNV-1a style hash over four interleaved 64 bit lanes so the multiplies overlap
+// Fed in pieces that are a multiple of 32 bytes, the registers and each memory page are
+typedef struct checksum
+{
+    uint64_t h[4];
+} Checksum;
+
+static void chip8_checksum_start(Checksum* pChecksum)
+{
+    pChecksum->h[0] = 0xCBF29CE484222325ULL;
+    pChecksum->h[1] = 0x84222325CBF29CE4ULL;
+    pChecksum->h[2] = 0x9CE484222325CBF2ULL;
+    pChecksum->h[3] = 0x2325CBF29CE48422ULL;
+}
+
+static void chip8_checksum_add(Checksum* pChecksum, const unsigned char* bytes, size_t size)
+{
+    uint64_t h0 = pChecksum->h[0], h1 = pChecksum->h[1], h2 = pChecksum->h[2], h3 = pChecksum->h[3];
+    for (size_t i = 0; i < size; i += 4 * sizeof(uint64_t))
+    {
+        uint64_t word[4];
+        memcpy(word, bytes + i, sizeof(word));
+        h0 = (h0 ^ word[0]) * 0x100000001B3ULL;
+        h1 = (h1 ^ word[1]) * 0x100000001B3ULL;
+        h2 = (h2 ^ word[2]) * 0x100000001B3ULL;
+        h3 = (h3 ^ word[3]) * 0x100000001B3ULL;
+    }
+    pChecksum->h[0] = h0;
+    pChecksum->h[1] = h1;
+    pChecksum->h[2] = h2;
+    pChecksum->h[3] = h3;
+}
+
+static uint32_t chip8_checksum_end(const Checksum* pChecksum)
+{
+    uint64_t hash = pChecksum->h[0] ^ (pChecksum->h[1] * 3) ^ (pChecksum->h[2] * 5) ^ (pChecksum->h[3] * 7);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static uint32_t chip8_checksum(const unsigned char* state, size_t size)
+{
+    Checksum checksum;
+    chip8_checksum_start(&checksum);
+    chip8_checksum_add(&checksum, state, size);
+    return chip8_checksum_end(&checksum);
+}
+
+size_t chip8_state_size(void)
+{
+    return sizeof(StateHeader) + CHIP8_STATE_BYTES;
+}
+
+Status chip8_save_state(CHIP8 hChip8, void* buffer, size_t size, Boolean checksum)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    if (size < chip8_state_size())
+        return FAILURE;
+
+    unsigned char* state = (unsigned char*)buffer + sizeof(StateHeader);
+    memcpy(state, pChip8, CHIP8_REGISTER_BYTES);
+    for (int page = 0; page < MEMORY_PAGES; page++)
+        memcpy(state + CHIP8_REGISTER_BYTES + page * MEMORY_PAGE_SIZE, pChip8->pages[page], MEMORY_PAGE_SIZE);
+
+    StateHeader header;
+    header.magic = STATE_MAGIC;
+    header.version = STATE_VERSION;
+    header.flags = checksum ? STATE_CHECKSUM : 0;
+    header.size = CHIP8_STATE_BYTES;
+    header.checksum = checksum ? chip8_checksum(state, CHIP8_STATE_BYTES) : 0;
+    memcpy(buffer, &header, sizeof(header));
+    return SUCCESS;
+}
+
+uint32_t chip8_get_state_hash(CHIP8 hChip8)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    // Events only say why the last run returned
+    unsigned char events = pChip8->events;
+    pChip8->events = 0;
+    Checksum checksum;
+    chip8_checksum_start(&checksum);
+    chip8_checksum_add(&checksum, (const unsigned char*)pChip8, CHIP8_REGISTER_BYTES);
+    for (int page = 0; page < MEMORY_PAGES; page++)
+        chip8_checksum_add(&checksum, pChip8->pages[page], MEMORY_PAGE_SIZE);
+    pChip8->events = events;
+    return chip8_checksum_end(&checksum);
+}
+
+// Compares what chip8_get_state_hash hashes, pages the two share are equal without looking at them
+Boolean chip8_same_state(CHIP8 hFirst, CHIP8 hSecond)
+{
+    Chip8* pFirst = (Chip8*)hFirst;
+    Chip8* pSecond = (Chip8*)hSecond;
+    unsigned char first_events = pFirst->events;
+    unsigned char second_events = pSecond->events;
+    pFirst->events = 0;
+    pSecond->events = 0;
+    Boolean same = memcmp(pFirst, pSecond, CHIP8_REGISTER_BYTES) == 0;
+    pFirst->events = first_events;
+    pSecond->events = second_events;
+    for (int page = 0; page < MEMORY_PAGES && same; page++)
+    {
+        if (pFirst->pages[page] != pSecond->pages[page])
+            same = memcmp(pFirst->pages[page], pSecond->pages[page], MEMORY_PAGE_SIZE) == 0;
+    }
+    return same;
+}
+
+Status chip8_load_state(CHIP8 hChip8, const void* buffer, size_t size)
+{
+    Chip8* pChip8 = (Chip8*)hChip8;
+    StateHeader header;
+    if (size < chip8_state_size())
+        return FAILURE;
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != STATE_MAGIC || header.version != STATE_VERSION || header.size != CHIP8_STATE_BYTES)
+        return FAILURE;
+
+    const unsigned char* state = (const unsigned char*)buffer + sizeof(StateHeader);
+    if ((header.flags & STATE_CHECKSUM) && chip8_checksum(state, CHIP8_STATE_BYTES) != header.checksum)
+        return FAILURE;
+
+    // The cores index the stack with sp unchecked, the timers stall without cycles per tick and xorshift only
+    // ever returns zero from a zero seed. Any pc is fine, fetches wrap it like a running machine's
+    unsigned short sp;
+    int cycles_per_tick;
+    uint64_t random;
+    memcpy(&sp, state + offsetof(Chip8, sp), sizeof(sp));
+    memcpy(&cycles_per_tick, state + offsetof(Chip8, cycles_per_tick), sizeof(cycles_per_tick));
+    memcpy(&random, state + offsetof(Chip8, random), sizeof(random));
+    if (sp > STACK_SIZE || cycles_per_tick <= 0 || random == 0)
+        return FAILURE;
+
+    // Only memory pages that differ are replaced so the decoded instructions and compiled blocks of the rest survive,
+    // pages that match the rom again go back to being shared
+    const unsigned char* memory = state + CHIP8_REGISTER_BYTES;
+    for (int page = 0; page < MEMORY_PAGES; page++)
+    {
+        const unsigned char* bytes = memory + page * MEMORY_PAGE_SIZE;
+        if (memcmp(pChip8->pages[page], bytes, MEMORY_PAGE_SIZE) != 0)
+            chip8_set_page(pChip8, page, bytes);
+    }
+    memcpy(pChip8, state, CHIP8_REGISTER_BYTES);
+
+    // Pending key events were queued for the old clock, they apply before the first instruction of the restored one
+    for (int i = 0; i < pChip8->key_event_count; i++)
+        pChip8->key_events[(pChip8->key_event_head + i) % KEY_EVENT_CAPACITY].cycle = pChip8->cycles;
+
+    // The restored screen has to be redrawn in full and the frame in progress starts over
+    pChip8->events = 0;
+    pChip8->frame_cycles_left = -1;
+    pChip8->dirty_rows = 0xFFFFFFFF;
+    pChip8->frame_sequence++;
+    return SUCCESS;
+}
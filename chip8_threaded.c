@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "chip8.h"
+#include "chip8_internal.h"
+#include "chip8_ops.h"
+
+// Direct threaded interpreter
+// Every handler ends by fetching the next predecoded instruction and jumping straight to its handler,
+// so each instruction costs one indirect jump from a branch site of its own instead of the nested switch
+
+#if defined(__GNUC__) || defined(__clang__)
+
+Boolean chip8_threaded_available(void)
+{
+    return TRUE;
+}
+
+int chip8_threaded_run(Chip8* pChip8, int cycles)
+{
+    // Indexed by Op, must follow the order of the enum
+    static const void* handlers[] =
+    {
+        &&op_unknown,
+        &&op_00E0, &&op_00EE, &&op_1NNN, &&op_2NNN, &&op_3XNN, &&op_4XNN, &&op_5XY0, &&op_6XNN, &&op_7XNN,
+        &&op_8XY0, &&op_8XY1, &&op_8XY2, &&op_8XY3, &&op_8XY4, &&op_8XY5, &&op_8XY6, &&op_8XY7, &&op_8XYE,
+        &&op_9XY0, &&op_ANNN, &&op_BNNN, &&op_CXNN, &&op_DXYN, &&op_EX9E, &&op_EXA1,
+        &&op_FX07, &&op_FX0A, &&op_FX15, &&op_FX18, &&op_FX1E, &&op_FX29, &&op_FX33, &&op_FX55, &&op_FX65,
+        &&op_idle, &&op_unknown
+    };
+    const Instruction* pInstruction;
+    int executed = 0;
+
+#define DISPATCH() \
+    pInstruction = chip8_fetch(pChip8, pChip8->pc); \
+    goto *handlers[pInstruction->op]
+#define NEXT() \
+    chip8_update_timers(pChip8); \
+    if (++executed == cycles || pChip8->events) \
+        return executed; \
+    DISPATCH()
+
+    if (cycles <= 0)
+        return 0;
+    DISPATCH();
+
+op_00E0: chip8_op_00E0(pChip8, pInstruction); NEXT();
+op_00EE: chip8_op_00EE(pChip8, pInstruction); NEXT();
+op_1NNN: chip8_op_1NNN(pChip8, pInstruction); NEXT();
+op_2NNN: chip8_op_2NNN(pChip8, pInstruction); NEXT();
+op_3XNN: chip8_op_3XNN(pChip8, pInstruction); NEXT();
+op_4XNN: chip8_op_4XNN(pChip8, pInstruction); NEXT();
+op_5XY0: chip8_op_5XY0(pChip8, pInstruction); NEXT();
+op_6XNN: chip8_op_6XNN(pChip8, pInstruction); NEXT();
+op_7XNN: chip8_op_7XNN(pChip8, pInstruction); NEXT();
+op_8XY0: chip8_op_8XY0(pChip8, pInstruction); NEXT();
+op_8XY1: chip8_op_8XY1(pChip8, pInstruction); NEXT();
+op_8XY2: chip8_op_8XY2(pChip8, pInstruction); NEXT();
+op_8XY3: chip8_op_8XY3(pChip8, pInstruction); NEXT();
+op_8XY4: chip8_op_8XY4(pChip8, pInstruction); NEXT();
+op_8XY5: chip8_op_8XY5(pChip8, pInstruction); NEXT();
+op_8XY6: chip8_op_8XY6(pChip8, pInstruction); NEXT();
+op_8XY7: chip8_op_8XY7(pChip8, pInstruction); NEXT();
+op_8XYE: chip8_op_8XYE(pChip8, pInstruction); NEXT();
+op_9XY0: chip8_op_9XY0(pChip8, pInstruction); NEXT();
+op_ANNN: chip8_op_ANNN(pChip8, pInstruction); NEXT();
+op_BNNN: chip8_op_BNNN(pChip8, pInstruction); NEXT();
+op_CXNN: chip8_op_CXNN(pChip8, pInstruction); NEXT();
+op_DXYN: chip8_op_DXYN(pChip8, pInstruction); NEXT();
+op_EX9E: chip8_op_EX9E(pChip8, pInstruction); NEXT();
+op_EXA1: chip8_op_EXA1(pChip8, pInstruction); NEXT();
+op_FX07: chip8_op_FX07(pChip8, pInstruction); NEXT();
+op_FX0A:
+    if (!chip8_op_FX0A(pChip8, pInstruction))
+    {
+        chip8_update_timers(pChip8);
+        return executed + 1;
+    }
+    NEXT();
+op_FX15: chip8_op_FX15(pChip8, pInstruction); NEXT();
+op_FX18: chip8_op_FX18(pChip8, pInstruction); NEXT();
+op_FX1E: chip8_op_FX1E(pChip8, pInstruction); NEXT();
+op_FX29: chip8_op_FX29(pChip8, pInstruction); NEXT();
+op_FX33: chip8_op_FX33(pChip8, pInstruction); NEXT();
+op_FX55: chip8_op_FX55(pChip8, pInstruction); NEXT();
+op_FX65: chip8_op_FX65(pChip8, pInstruction); NEXT();
+op_idle: chip8_op_idle(pChip8, pInstruction); NEXT();
+op_unknown: chip8_op_unknown(pChip8, pInstruction); NEXT();
+
+#undef NEXT
+#undef DISPATCH
+}
+
+#else
+
+// No labels as values, chip8_set_core(hChip8, CORE_THREADED) fails and builds defaulting to it use the switch interpreter
+
+Boolean chip8_threaded_available(void)
+{
+    return FALSE;
+}
+
+int chip8_threaded_run(Chip8* pChip8, int cycles)
+{
+    return chip8_interpret(pChip8, cycles);
+}
+
+#endif
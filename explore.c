@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+
+// Breadth first search over key presses, for playtesting and finding the shortest input that gets a rom
+// to a given screen. Every step forks each state once per action, no key or one key held for the step, and
+// runs the fork for a few frames. Each step runs the same number of cycles, so states are only ever equal to
+// states at the same depth, and forks that end in the same state as an earlier fork of their depth are dropped.
+// The frontier only holds distinct machines
+
+#define NO_KEY -1
+
+typedef struct node
+{
+    int parent; // Node this one was forked from, -1 for the start
+    int key;    // Key held during the step that led here
+} Node;
+
+// Open addressing over the states reached at one depth, a slot holds the state's index in the frontier plus
+// one above its hash, 0 marks an empty slot. The hash only picks the slot, states with the same hash are
+// compared in full so a collision never drops a state
+typedef struct state_set
+{
+    uint64_t* slots;
+    int capacity;
+    int count;
+} StateSet;
+
+typedef struct search
+{
+    int frames;     // Frames run per step
+    int max_depth;
+    int max_states; // Nodes kept before the search stops forking
+    int keys[NUM_OF_KEYS + 1];
+    int key_count;
+    Boolean has_goal;
+    uint64_t goal_screen;
+} Search;
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static Status state_set_init(StateSet* pSet, int capacity)
+{
+    pSet->capacity = capacity;
+    pSet->count = 0;
+    pSet->slots = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+    return pSet->slots != NULL ? SUCCESS : FAILURE;
+}
+
+static void state_set_clear(StateSet* pSet)
+{
+    memset(pSet->slots, 0, pSet->capacity * sizeof(uint64_t));
+    pSet->count = 0;
+}
+
+static void state_set_put(StateSet* pSet, uint64_t slot)
+{
+    uint32_t hash = (uint32_t)slot;
+    int i = (int)((hash * 0x9E3779B1u) & (pSet->capacity - 1));
+    while (pSet->slots[i] != 0)
+        i = (i + 1) & (pSet->capacity - 1);
+    pSet->slots[i] = slot;
+    pSet->count++;
+}
+
+// Returns TRUE when hState was added as states[index], FALSE when an equal state is already there
+static Boolean state_set_add(StateSet* pSet, CHIP8* states, CHIP8 hState, int index)
+{
+    if (2 * (pSet->count + 1) > pSet->capacity)
+    {
+        StateSet grown;
+        if (state_set_init(&grown, pSet->capacity * 2) == FAILURE)
+        {
+            printf("Failed to grow the seen states, duplicates are no longer dropped!\n");
+            return TRUE;
+        }
+        for (int i = 0; i < pSet->capacity; i++)
+        {
+            if (pSet->slots[i] != 0)
+                state_set_put(&grown, pSet->slots[i]);
+        }
+        free(pSet->slots);
+        *pSet = grown;
+    }
+
+    uint32_t hash = chip8_get_state_hash(hState);
+    int i = (int)((hash * 0x9E3779B1u) & (pSet->capacity - 1));
+    while (pSet->slots[i] != 0)
+    {
+        uint64_t slot = pSet->slots[i];
+        if ((uint32_t)slot == hash && chip8_same_state(states[(slot >> 32) - 1], hState))
+            return FALSE;
+        i = (i + 1) & (pSet->capacity - 1);
+    }
+    state_set_put(pSet, (uint64_t)(index + 1) << 32 | hash);
+    return TRUE;
+}
+
+static void run_step(CHIP8 hChip8, int key, int frames)
+{
+    if (key != NO_KEY)
+        chip8_set_key(hChip8, key, 1);
+    for (int i = 0; i < frames; i++)
+    {
+        RunStatus status;
+        do
+        {
+            status = chip8_run_frame(hChip8);
+        } while (status == RUN_DRAW || status == RUN_SOUND);
+    }
+    if (key != NO_KEY)
+        chip8_set_key(hChip8, key, 0);
+}
+
+static void print_path(const Node* nodes, int index)
+{
+    int path[256];
+    int length = 0;
+    for (int i = index; nodes[i].parent >= 0 && length < 256; i = nodes[i].parent)
+        path[length++] = nodes[i].key;
+    printf("keys       ");
+    for (int i = length - 1; i >= 0; i--)
+    {
+        if (path[i] == NO_KEY)
+            printf(" -");
+        else
+            printf(" %X", path[i]);
+    }
+    printf("\n");
+}
+
+static void explore(CHIP8 hStart, const Search* pSearch)
+{
+    Node* nodes = (Node*)malloc(pSearch->max_states * sizeof(Node));
+    CHIP8* frontier = (CHIP8*)malloc(pSearch->max_states * sizeof(CHIP8));
+    CHIP8* next = (CHIP8*)malloc(pSearch->max_states * sizeof(CHIP8));
+    int* frontier_nodes = (int*)malloc(pSearch->max_states * sizeof(int));
+    int* next_nodes = (int*)malloc(pSearch->max_states * sizeof(int));
+    StateSet seen;
+    if (nodes == NULL || frontier == NULL || next == NULL || frontier_nodes == NULL || next_nodes == NULL ||
+        state_set_init(&seen, 1024) == FAILURE)
+    {
+        printf("Failed to allocate the search!\n");
+        exit(1);
+    }
+
+    nodes[0].parent = -1;
+    nodes[0].key = NO_KEY;
+    int node_count = 1;
+    frontier[0] = hStart;
+    frontier_nodes[0] = 0;
+    int frontier_count = 1;
+
+    long long forks = 0;
+    long long duplicates = 0;
+    int goal = -1;
+    double start = now_seconds();
+    for (int depth = 1; depth <= pSearch->max_depth && frontier_count > 0 && goal < 0; depth++)
+    {
+        int next_count = 0;
+        long long depth_duplicates = duplicates;
+        state_set_clear(&seen);
+        for (int i = 0; i < frontier_count; i++)
+        {
+            for (int k = 0; k < pSearch->key_count && goal < 0 && node_count < pSearch->max_states; k++)
+            {
+                CHIP8 hFork = chip8_clone(frontier[i]);
+                if (hFork == NULL)
+                {
+                    printf("Failed to fork a state, the search stops at depth %d!\n", depth);
+                    break;
+                }
+                forks++;
+                run_step(hFork, pSearch->keys[k], pSearch->frames);
+                if (!state_set_add(&seen, next, hFork, next_count))
+                {
+                    duplicates++;
+                    chip8_destory(&hFork);
+                    continue;
+                }
+
+                nodes[node_count].parent = frontier_nodes[i];
+                nodes[node_count].key = pSearch->keys[k];
+                if (pSearch->has_goal && chip8_get_screen_hash(hFork) == pSearch->goal_screen)
+                    goal = node_count;
+                next[next_count] = hFork;
+                next_nodes[next_count++] = node_count++;
+            }
+            // Destroyed states go back to the pool and come out again as the next forks
+            chip8_destory(&frontier[i]);
+        }
+
+        printf("depth %3d  %8d new states  %8lld duplicates\n", depth, next_count, duplicates - depth_duplicates);
+        CHIP8* swap_states = frontier;
+        frontier = next;
+        next = swap_states;
+        int* swap_nodes = frontier_nodes;
+        frontier_nodes = next_nodes;
+        next_nodes = swap_nodes;
+        frontier_count = next_count;
+        if (node_count >= pSearch->max_states && goal < 0)
+        {
+            printf("Reached %d states, stopping here!\n", pSearch->max_states);
+            break;
+        }
+    }
+    double seconds = now_seconds() - start;
+
+    printf("states     %d\n", node_count);
+    printf("forks      %lld, %.0f per second\n", forks, seconds > 0 ? forks / seconds : 0.0);
+    printf("duplicates %lld\n", duplicates);
+    if (goal >= 0)
+        print_path(nodes, goal);
+    else if (pSearch->has_goal)
+        printf("Goal screen not reached!\n");
+
+    for (int i = 0; i < frontier_count; i++)
+        chip8_destory(&frontier[i]);
+    free(nodes);
+    free(frontier);
+    free(next);
+    free(frontier_nodes);
+    free(next_nodes);
+    free(seen.slots);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("Program Usage: CHIP8_EXPLORE <rom_path> [--frames n] [--depth n] [--states n] [--keys 0123...F] [--goal screen_hash] [--ips n] [--seed n]\n");
+        exit(1);
+    }
+
+    Search search;
+    search.frames = 10;
+    search.max_depth = 8;
+    search.max_states = 1000000;
+    search.has_goal = FALSE;
+    search.goal_screen = 0;
+    const char* keys = "0123456789ABCDEF";
+    int instructions_per_second = FRAME_RATE * CYCLES_PER_FRAME;
+    uint64_t seed = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            search.frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--depth") && i + 1 < argc)
+            search.max_depth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--states") && i + 1 < argc)
+            search.max_states = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--keys") && i + 1 < argc)
+            keys = argv[++i];
+        else if (!strcmp(argv[i], "--goal") && i + 1 < argc)
+        {
+            search.has_goal = TRUE;
+            search.goal_screen = strtoull(argv[++i], NULL, 16);
+        }
+        else if (!strcmp(argv[i], "--ips") && i + 1 < argc)
+            instructions_per_second = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+    }
+    if (search.max_states < 1)
+        search.max_states = 1;
+
+    // Doing nothing is always an option, then one action per key listed
+    search.keys[0] = NO_KEY;
+    search.key_count = 1;
+    for (const char* c = keys; *c != '\0' && search.key_count <= NUM_OF_KEYS; c++)
+    {
+        char digit[2] = {*c, '\0'};
+        char* end;
+        long key = strtol(digit, &end, 16);
+        if (*end == '\0')
+            search.keys[search.key_count++] = (int)key;
+    }
+
+    CHIP8 hChip8 = chip8_init_default();
+    if (hChip8 == NULL || chip8_load_rom_file(hChip8, argv[1]) == FAILURE)
+    {
+        printf("Failed to load %s!\n", argv[1]);
+        exit(1);
+    }
+    chip8_set_report_unknown(hChip8, FALSE);
+    chip8_set_ips(hChip8, instructions_per_second);
+    chip8_seed(hChip8, seed);
+
+    explore(hChip8, &search);
+    return 0;
+}
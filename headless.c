@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "chip8.h"
+#include "input_log.h"
+#include "work_pool.h"
+
+// Runs roms without a window or sound as fast as possible and prints a hash of the screen they ended on
+// For batch work and checks on machines with no display, the hash only depends on the rom, seed and input
+// With --batch every line of a file is a run of its own, with the same options as the command line, and
+// the runs are spread over a thread pool with their results streamed to a JSON lines or CSV file
+
+#define BATCH_SIZE 1000
+#define MAX_JOB_ARGS 16
+
+typedef struct job
+{
+    const char* rom_path;
+    const char* replay_path;
+    const char* core_name;
+    const char* profile_path; // Opcode profile written here when set
+    const char* stacks_path;  // Folded call stacks written here when set
+    const char* labels_path;  // Routine names for the call stacks
+    int stack_interval;       // Cycles between call stack samples
+    long long cycles;
+    long long frames;
+    int instructions_per_second;
+    uint64_t seed;
+} Job;
+
+typedef struct result
+{
+    const char* error; // NULL when the run went through
+    uint64_t cycles;
+    uint64_t screen_hash;
+    uint32_t state_hash;
+    uint64_t unknown_opcodes;
+    double seconds;
+    size_t private_bytes; // Memory the instance held for itself at the end of the run
+    size_t shared_bytes;  // Memory it shared with other instances running the same rom
+} Result;
+
+typedef struct worker_totals
+{
+    uint64_t cycles;
+    uint64_t private_bytes;
+    uint64_t shared_bytes;
+} WorkerTotals;
+
+typedef struct batch
+{
+    Job* jobs;
+    FILE* output;
+    Boolean csv;
+    pthread_mutex_t output_lock;
+    WorkerTotals* worker_totals; // Summed over the jobs each worker ran
+} Batch;
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static Boolean is_csv_path(const char* path)
+{
+    size_t length = path != NULL ? strlen(path) : 0;
+    return length >= 4 && !strcmp(path + length - 4, ".csv");
+}
+
+// Fills in a job from command line style arguments, argv[0] is the rom
+static void parse_job(int argc, char* argv[], Job* pJob)
+{
+    pJob->rom_path = argv[0];
+    pJob->replay_path = NULL;
+    pJob->core_name = NULL;
+    pJob->profile_path = NULL;
+    pJob->stacks_path = NULL;
+    pJob->labels_path = NULL;
+    pJob->stack_interval = 1;
+    pJob->cycles = 0;
+    pJob->frames = 0;
+    pJob->instructions_per_second = FRAME_RATE * CYCLES_PER_FRAME;
+    pJob->seed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--cycles") && i + 1 < argc)
+            pJob->cycles = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            pJob->frames = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+            pJob->replay_path = argv[++i];
+        else if (!strcmp(argv[i], "--core") && i + 1 < argc)
+            pJob->core_name = argv[++i];
+        else if (!strcmp(argv[i], "--ips") && i + 1 < argc)
+            pJob->instructions_per_second = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            pJob->seed = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+            pJob->profile_path = argv[++i];
+        else if (!strcmp(argv[i], "--stacks") && i + 1 < argc)
+            pJob->stacks_path = argv[++i];
+        else if (!strcmp(argv[i], "--stack-interval") && i + 1 < argc)
+            pJob->stack_interval = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--labels") && i + 1 < argc)
+            pJob->labels_path = argv[++i];
+    }
+    if (pJob->cycles == 0 && pJob->frames == 0 && pJob->replay_path == NULL)
+        pJob->cycles = 100000000;
+}
+
+static void run_job(const Job* pJob, Boolean report_unknown, Result* pResult)
+{
+    memset(pResult, 0, sizeof(Result));
+    CHIP8 hChip8 = chip8_init_default();
+    if (hChip8 == NULL)
+    {
+        pResult->error = "out of memory";
+        return;
+    }
+    chip8_set_report_unknown(hChip8, report_unknown);
+    if (chip8_load_rom_file(hChip8, pJob->rom_path) == FAILURE)
+    {
+        pResult->error = "failed to load the rom";
+        chip8_destory(&hChip8);
+        return;
+    }
+
+    if (pJob->core_name != NULL)
+    {
+        const char* names[] = {"interpreter", "jit", "threaded"};
+        Core cores[] = {CORE_INTERPRETER, CORE_JIT, CORE_THREADED};
+        int i = 0;
+        while (i < 3 && strcmp(pJob->core_name, names[i]))
+            i++;
+        if (i == 3 || chip8_set_core(hChip8, cores[i]) == FAILURE)
+        {
+            pResult->error = "core not available in this build";
+            chip8_destory(&hChip8);
+            return;
+        }
+    }
+    chip8_set_ips(hChip8, pJob->instructions_per_second);
+    chip8_seed(hChip8, pJob->seed);
+    if ((pJob->profile_path != NULL && chip8_set_profiling(hChip8, TRUE) == FAILURE) ||
+        (pJob->stacks_path != NULL && chip8_set_stack_sampling(hChip8, pJob->stack_interval > 0 ? pJob->stack_interval : 1) == FAILURE))
+    {
+        pResult->error = "profiler not available in this build";
+        chip8_destory(&hChip8);
+        return;
+    }
+
+    double start = now_seconds();
+    if (pJob->replay_path != NULL)
+    {
+        // The log brings its own seed and speed
+        INPUT_LOG hLog = input_log_open(pJob->replay_path);
+        if (hLog == NULL)
+            pResult->error = "failed to open the input log";
+        else
+        {
+            if (input_log_replay(hLog, hChip8) == FAILURE)
+                pResult->error = "replay did not line up with the log";
+            input_log_close(&hLog);
+        }
+    }
+    else if (pJob->frames > 0)
+    {
+        for (long long i = 0; i < pJob->frames; i++)
+        {
+            RunStatus status;
+            do
+            {
+                status = chip8_run_frame(hChip8);
+            } while (status == RUN_DRAW || status == RUN_SOUND);
+        }
+    }
+    else
+    {
+        // Nothing presses a key, so a rom waiting on FX0A just burns the rest of the cycles
+        while (chip8_get_cycles(hChip8) < (uint64_t)pJob->cycles)
+        {
+            uint64_t left = pJob->cycles - chip8_get_cycles(hChip8);
+            chip8_run_cycles(hChip8, left < BATCH_SIZE ? (int)left : BATCH_SIZE, NULL);
+        }
+    }
+    pResult->seconds = now_seconds() - start;
+    pResult->cycles = chip8_get_cycles(hChip8);
+    pResult->screen_hash = chip8_get_screen_hash(hChip8);
+    pResult->state_hash = chip8_get_state_hash(hChip8);
+    pResult->unknown_opcodes = chip8_get_unknown_opcodes(hChip8);
+    pResult->private_bytes = chip8_get_private_bytes(hChip8);
+    pResult->shared_bytes = chip8_get_shared_bytes(hChip8);
+    if (pJob->profile_path != NULL && chip8_write_profile_file(hChip8, pJob->profile_path) == FAILURE)
+        pResult->error = "failed to write the profile";
+    if (pJob->stacks_path != NULL)
+    {
+        FILE* labels = pJob->labels_path != NULL ? fopen(pJob->labels_path, "r") : NULL;
+        FILE* fp = fopen(pJob->stacks_path, "w");
+        if (pJob->labels_path != NULL && labels == NULL)
+            pResult->error = "failed to open the labels";
+        else if (fp == NULL || chip8_write_stacks(hChip8, fp, labels) == FAILURE)
+            pResult->error = "failed to write the call stacks";
+        if (fp != NULL)
+            fclose(fp);
+        if (labels != NULL)
+            fclose(labels);
+    }
+    chip8_destory(&hChip8);
+}
+
+static void write_result(Batch* pBatch, int index, const Result* pResult)
+{
+    const Job* pJob = &pBatch->jobs[index];
+    pthread_mutex_lock(&pBatch->output_lock);
+    if (pBatch->csv)
+    {
+        // Paths are written as they are, quoted when they hold a comma or quote
+        Boolean quote = strpbrk(pJob->rom_path, ",\"") != NULL;
+        fprintf(pBatch->output, "%d,%s", index, quote ? "\"" : "");
+        for (const char* c = pJob->rom_path; *c; c++)
+            fprintf(pBatch->output, *c == '"' ? "\"\"" : "%c", *c);
+        fprintf(pBatch->output, "%s,%llu,%llu,%016llx,%08x,%llu,%.6f,%s\n", quote ? "\"" : "",
+                (unsigned long long)pJob->seed, (unsigned long long)pResult->cycles, (unsigned long long)pResult->screen_hash,
+                pResult->state_hash, (unsigned long long)pResult->unknown_opcodes, pResult->seconds,
+                pResult->error != NULL ? pResult->error : "");
+    }
+    else
+    {
+        fprintf(pBatch->output, "{\"job\": %d, \"rom\": \"", index);
+        for (const char* c = pJob->rom_path; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                fputc('\\', pBatch->output);
+            fputc(*c, pBatch->output);
+        }
+        fprintf(pBatch->output, "\", \"seed\": %llu, \"cycles\": %llu, \"screen_hash\": \"%016llx\", \"state_hash\": \"%08x\", "
+                "\"unknown_opcodes\": %llu, \"seconds\": %.6f",
+                (unsigned long long)pJob->seed, (unsigned long long)pResult->cycles, (unsigned long long)pResult->screen_hash,
+                pResult->state_hash, (unsigned long long)pResult->unknown_opcodes, pResult->seconds);
+        if (pResult->error != NULL)
+            fprintf(pBatch->output, ", \"error\": \"%s\"", pResult->error);
+        fprintf(pBatch->output, "}\n");
+    }
+    pthread_mutex_unlock(&pBatch->output_lock);
+}
+
+static void run_batch_job(void* context, int item, int worker)
+{
+    Batch* pBatch = (Batch*)context;
+    Result result;
+    run_job(&pBatch->jobs[item], FALSE, &result);
+    WorkerTotals* pTotals = &pBatch->worker_totals[worker];
+    pTotals->cycles += result.cycles;
+    pTotals->private_bytes += result.private_bytes;
+    pTotals->shared_bytes += result.shared_bytes;
+    write_result(pBatch, item, &result);
+}
+
+// Reads one job per line, blank lines and lines starting with # are skipped
+static int read_jobs(const char* path, Job** ppJobs)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    int count = 0;
+    int capacity = 0;
+    Job* pJobs = NULL;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        // Arguments point into a copy of the line that lives as long as the jobs
+        char* copy = strdup(line);
+        if (copy == NULL)
+            break;
+        char* args[MAX_JOB_ARGS];
+        int argc = 0;
+        for (char* arg = strtok(copy, " \t\r\n"); arg != NULL && argc < MAX_JOB_ARGS; arg = strtok(NULL, " \t\r\n"))
+            args[argc++] = arg;
+        if (argc == 0 || args[0][0] == '#')
+        {
+            free(copy);
+            continue;
+        }
+        if (count == capacity)
+        {
+            Job* pGrown = (Job*)realloc(pJobs, (capacity == 0 ? 64 : capacity * 2) * sizeof(Job));
+            if (pGrown == NULL)
+            {
+                free(copy);
+                break;
+            }
+            pJobs = pGrown;
+            capacity = capacity == 0 ? 64 : capacity * 2;
+        }
+        parse_job(argc, args, &pJobs[count++]);
+    }
+    // Out of memory part way through the file fails like a file that could not be read
+    Boolean complete = feof(fp) && !ferror(fp);
+    fclose(fp);
+    if (!complete)
+    {
+        free(pJobs);
+        return -1;
+    }
+    *ppJobs = pJobs;
+    return count;
+}
+
+static int run_batch(const char* jobs_path, const char* output_path, int threads)
+{
+    Batch batch;
+    int count = read_jobs(jobs_path, &batch.jobs);
+    if (count < 0)
+    {
+        printf("Failed to read the jobs from %s!\n", jobs_path);
+        return 1;
+    }
+    batch.output = output_path != NULL ? fopen(output_path, "w") : stdout;
+    if (batch.output == NULL)
+    {
+        printf("Failed to create %s!\n", output_path);
+        return 1;
+    }
+    batch.csv = is_csv_path(output_path);
+    if (batch.csv)
+        fprintf(batch.output, "job,rom,seed,cycles,screen_hash,state_hash,unknown_opcodes,seconds,error\n");
+    pthread_mutex_init(&batch.output_lock, NULL);
+
+    WORK_POOL hPool = work_pool_init_default(threads);
+    if (hPool == NULL)
+    {
+        printf("Failed to start the worker threads!\n");
+        return 1;
+    }
+    batch.worker_totals = (WorkerTotals*)calloc(work_pool_get_threads(hPool), sizeof(WorkerTotals));
+    if (batch.worker_totals == NULL)
+    {
+        printf("Failed to allocate the worker totals!\n");
+        return 1;
+    }
+
+    double start = now_seconds();
+    work_pool_run(hPool, count, run_batch_job, &batch);
+    double seconds = now_seconds() - start;
+
+    WorkerTotals totals = {0};
+    for (int i = 0; i < work_pool_get_threads(hPool); i++)
+    {
+        totals.cycles += batch.worker_totals[i].cycles;
+        totals.private_bytes += batch.worker_totals[i].private_bytes;
+        totals.shared_bytes += batch.worker_totals[i].shared_bytes;
+    }
+    fprintf(stderr, "%d jobs on %d threads in %.3f s, %.1f million instructions per second, %lld jobs stolen\n", count,
+            work_pool_get_threads(hPool), seconds, seconds > 0 ? totals.cycles / seconds / 1e6 : 0.0, work_pool_get_steals(hPool));
+    // Shared bytes are what every instance would have held for itself without the rom images
+    if (count > 0)
+        fprintf(stderr, "%.1f KiB private per instance, %.1f KiB more shared through rom images\n",
+                totals.private_bytes / 1024.0 / count, totals.shared_bytes / 1024.0 / count);
+
+    work_pool_destroy(&hPool);
+    if (batch.output != stdout)
+        fclose(batch.output);
+    pthread_mutex_destroy(&batch.output_lock);
+    free(batch.worker_totals);
+    free(batch.jobs); // The job strings stay allocated until exit
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("Program Usage: CHIP8_HEADLESS <rom_path> [--cycles n | --frames n | --replay log] [--core interpreter|jit|threaded] [--ips n] [--seed n] [--profile out.json|out.csv]\n");
+        printf("               [--stacks out.folded [--stack-interval n] [--labels labels.txt]]\n");
+        printf("               CHIP8_HEADLESS --batch <jobs_path> [--output results.jsonl|results.csv] [--threads n]\n");
+        exit(1);
+    }
+
+    if (!strcmp(argv[1], "--batch"))
+    {
+        if (argc < 3)
+        {
+            printf("--batch needs a file with one run per line!\n");
+            exit(1);
+        }
+        const char* output_path = NULL;
+        int threads = 0;
+        for (int i = 3; i < argc; i++)
+        {
+            if (!strcmp(argv[i], "--output") && i + 1 < argc)
+                output_path = argv[++i];
+            else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+                threads = atoi(argv[++i]);
+        }
+        return run_batch(argv[2], output_path, threads);
+    }
+
+    Job job;
+    Result result;
+    parse_job(argc - 1, argv + 1, &job);
+    run_job(&job, TRUE, &result);
+    if (result.error != NULL && result.cycles == 0)
+    {
+        printf("Run failed: %s!\n", result.error);
+        exit(1);
+    }
+
+    printf("cycles      %llu\n", (unsigned long long)result.cycles);
+    printf("seconds     %.3f\n", result.seconds);
+    printf("mips        %.1f\n", result.seconds > 0 ? result.cycles / result.seconds / 1e6 : 0.0);
+    printf("screen hash %016llx\n", (unsigned long long)result.screen_hash);
+    printf("state hash  %08x\n", result.state_hash);
+    printf("unknown     %llu\n", (unsigned long long)result.unknown_opcodes);
+    printf("memory      %zu bytes private, %zu bytes shared\n", result.private_bytes, result.shared_bytes);
+    if (result.error != NULL)
+        printf("Run failed: %s!\n", result.error);
+    return result.error == NULL ? 0 : 1;
+}
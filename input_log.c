@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "input_log.h"
+
+// File layout, every field little endian
+// Header: "C8IN", version (2 bytes), 2 reserved bytes, ips (4 bytes), seed (8 bytes)
+// Then one record per event: cycle (8 bytes), key, state. The last record has key END_KEY and the end cycle
+
+#define LOG_VERSION 1
+#define HEADER_SIZE 20
+#define RECORD_SIZE 10
+#define END_KEY 0xFF
+
+typedef struct input_log
+{
+    FILE* fp;
+    uint64_t seed;
+    int ips;
+} InputLog;
+
+static void input_log_put(unsigned char* out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint64_t input_log_get(const unsigned char* in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+static Status input_log_put_record(InputLog* pLog, uint64_t cycle, int key, int state)
+{
+    unsigned char record[RECORD_SIZE];
+    input_log_put(record, cycle, 8);
+    record[8] = (unsigned char)key;
+    record[9] = (unsigned char)state;
+    return fwrite(record, RECORD_SIZE, 1, pLog->fp) == 1 ? SUCCESS : FAILURE;
+}
+
+static Boolean input_log_get_record(InputLog* pLog, uint64_t* pCycle, int* pKey, int* pState)
+{
+    unsigned char record[RECORD_SIZE];
+    if (fread(record, RECORD_SIZE, 1, pLog->fp) != 1)
+        return FALSE;
+    *pCycle = input_log_get(record, 8);
+    *pKey = record[8];
+    *pState = record[9];
+    // A damaged log is cut off at the first record that names no CHIP8 key
+    return *pKey < NUM_OF_KEYS || *pKey == END_KEY;
+}
+
+INPUT_LOG input_log_create(const char* path, uint64_t seed, int ips)
+{
+    InputLog* pLog = (InputLog*)malloc(sizeof(InputLog));
+    if (pLog == NULL)
+        return NULL;
+    pLog->fp = fopen(path, "wb");
+    pLog->seed = seed;
+    pLog->ips = ips;
+
+    unsigned char header[HEADER_SIZE] = {'C', '8', 'I', 'N'};
+    input_log_put(header + 4, LOG_VERSION, 2);
+    input_log_put(header + 8, (uint64_t)ips, 4);
+    input_log_put(header + 12, seed, 8);
+    if (pLog->fp == NULL || fwrite(header, HEADER_SIZE, 1, pLog->fp) != 1)
+    {
+        input_log_close((INPUT_LOG*)&pLog);
+        return NULL;
+    }
+    return pLog;
+}
+
+Status input_log_write(INPUT_LOG hLog, uint64_t cycle, int key_index, int state)
+{
+    InputLog* pLog = (InputLog*)hLog;
+    return input_log_put_record(pLog, cycle, key_index, state);
+}
+
+Status input_log_finish(INPUT_LOG hLog, uint64_t cycle)
+{
+    InputLog* pLog = (InputLog*)hLog;
+    if (input_log_put_record(pLog, cycle, END_KEY, 0) == FAILURE)
+        return FAILURE;
+    return fflush(pLog->fp) == 0 ? SUCCESS : FAILURE;
+}
+
+INPUT_LOG input_log_open(const char* path)
+{
+    InputLog* pLog = (InputLog*)malloc(sizeof(InputLog));
+    if (pLog == NULL)
+        return NULL;
+    pLog->fp = fopen(path, "rb");
+
+    unsigned char header[HEADER_SIZE];
+    if (pLog->fp == NULL || fread(header, HEADER_SIZE, 1, pLog->fp) != 1 || header[0] != 'C' || header[1] != '8' ||
+        header[2] != 'I' || header[3] != 'N' || input_log_get(header + 4, 2) != LOG_VERSION)
+    {
+        input_log_close((INPUT_LOG*)&pLog);
+        return NULL;
+    }
+    pLog->ips = (int)input_log_get(header + 8, 4);
+    pLog->seed = input_log_get(header + 12, 8);
+    return pLog;
+}
+
+uint64_t input_log_get_seed(INPUT_LOG hLog)
+{
+    InputLog* pLog = (InputLog*)hLog;
+    return pLog->seed;
+}
+
+int input_log_get_ips(INPUT_LOG hLog)
+{
+    InputLog* pLog = (InputLog*)hLog;
+    return pLog->ips;
+}
+
+Status input_log_replay(INPUT_LOG hLog, CHIP8 hChip8)
+{
+    InputLog* pLog = (InputLog*)hLog;
+    // Starts over from the rom at the recorded speed, so the first timer tick falls where it did while recording
+    // whatever speed the instance was set to before
+    chip8_set_ips(hChip8, pLog->ips);
+    chip8_reset(hChip8);
+    chip8_seed(hChip8, pLog->seed);
+
+    uint64_t cycle;
+    int key, state;
+    if (!input_log_get_record(pLog, &cycle, &key, &state))
+        return FAILURE;
+    while (TRUE)
+    {
+        // Events were queued at the start of a frame with the cycle it started on, runs the same frames as the
+        // emulation thread did so each one is queued at the same point
+        uint64_t now = chip8_get_cycles(hChip8);
+        while (key != END_KEY && cycle == now)
+        {
+            if (chip8_queue_key(hChip8, key, state, cycle) == FAILURE ||
+                !input_log_get_record(pLog, &cycle, &key, &state))
+                return FAILURE;
+        }
+        if (cycle < now)
+            return FAILURE;
+        if (key == END_KEY && cycle == now)
+            return SUCCESS;
+
+        RunStatus status;
+        do
+        {
+            status = chip8_run_frame(hChip8);
+        } while (status == RUN_DRAW || status == RUN_SOUND);
+    }
+}
+
+void input_log_close(INPUT_LOG* phLog)
+{
+    InputLog* pLog = (InputLog*)*phLog;
+    if (pLog->fp != NULL)
+        fclose(pLog->fp);
+    free(pLog);
+    *phLog = NULL;
+}
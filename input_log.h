@@ -0,0 +1,30 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// Recording of a session's key events for replaying it exactly, with the seed and speed it ran at
+// Events are stored with the cycle chip8_queue_key got, so a replay that runs frames the same way
+// applies every one of them on the same cycle and ends in the same state
+
+typedef void* INPUT_LOG;
+
+// Starts a new log at path for a session with this seed and speed
+INPUT_LOG input_log_create(const char* path, uint64_t seed, int ips);
+Status input_log_write(INPUT_LOG hLog, uint64_t cycle, int key_index, int state);
+// Marks where the session ended, a replay stops on this cycle
+Status input_log_finish(INPUT_LOG hLog, uint64_t cycle);
+
+// Opens a finished log for replaying, NULL when it is missing or not a log
+INPUT_LOG input_log_open(const char* path);
+uint64_t input_log_get_seed(INPUT_LOG hLog);
+int input_log_get_ips(INPUT_LOG hLog);
+// Runs the session on a CHIP8 with the rom loaded as fast as possible, it is reset to the start of the rom and
+// seeded and sped up from the log
+// FAILURE when the log is cut short or the run stops lining up with the cycles of its events
+Status input_log_replay(INPUT_LOG hLog, CHIP8 hChip8);
+
+void input_log_close(INPUT_LOG* phLog);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "input_queue.h"
+
+typedef struct input_queue
+{
+    InputEvent* events;
+    unsigned int mask;
+    atomic_uint head; // Next event to pop, only written by the consumer
+    atomic_uint tail; // Next free slot, only written by the producer
+} InputQueue;
+
+INPUT_QUEUE input_queue_init_default(int capacity)
+{
+    InputQueue* pQueue = (InputQueue*)malloc(sizeof(InputQueue));
+    if (pQueue != NULL)
+    {
+        unsigned int size = 1;
+        while (size < (unsigned int)capacity)
+            size <<= 1;
+        pQueue->events = (InputEvent*)malloc(size * sizeof(InputEvent));
+        if (pQueue->events == NULL)
+        {
+            free(pQueue);
+            return NULL;
+        }
+        pQueue->mask = size - 1;
+        atomic_init(&pQueue->head, 0);
+        atomic_init(&pQueue->tail, 0);
+    }
+    return pQueue;
+}
+
+Boolean input_queue_push(INPUT_QUEUE hQueue, InputEvent event)
+{
+    InputQueue* pQueue = (InputQueue*)hQueue;
+    unsigned int tail = atomic_load_explicit(&pQueue->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&pQueue->head, memory_order_acquire) > pQueue->mask)
+        return FALSE;
+    pQueue->events[tail & pQueue->mask] = event;
+    atomic_store_explicit(&pQueue->tail, tail + 1, memory_order_release);
+    return TRUE;
+}
+
+Boolean input_queue_pop(INPUT_QUEUE hQueue, InputEvent* pEvent)
+{
+    InputQueue* pQueue = (InputQueue*)hQueue;
+    unsigned int head = atomic_load_explicit(&pQueue->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&pQueue->tail, memory_order_acquire))
+        return FALSE;
+    *pEvent = pQueue->events[head & pQueue->mask];
+    atomic_store_explicit(&pQueue->head, head + 1, memory_order_release);
+    return TRUE;
+}
+
+void input_queue_destroy(INPUT_QUEUE* phQueue)
+{
+    InputQueue* pQueue = (InputQueue*)*phQueue;
+    free(pQueue->events);
+    free(pQueue);
+    *phQueue = NULL;
+}
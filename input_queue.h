@@ -0,0 +1,25 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include "chip8.h"
+
+// Lock free single producer single consumer queue of key events, the window thread pushes and the
+// emulation thread pops so neither has to lock the other out
+
+typedef void* INPUT_QUEUE;
+
+typedef struct input_event
+{
+    unsigned char key;   // CHIP8 key, 0x0 to 0xF
+    unsigned char state; // 1 pressed, 0 released
+} InputEvent;
+
+// capacity is rounded up to a power of two
+INPUT_QUEUE input_queue_init_default(int capacity);
+// Returns FALSE and drops the event when the queue is full
+Boolean input_queue_push(INPUT_QUEUE hQueue, InputEvent event);
+// Returns FALSE when the queue is empty
+Boolean input_queue_pop(INPUT_QUEUE hQueue, InputEvent* pEvent);
+void input_queue_destroy(INPUT_QUEUE* phQueue);
+
+#endif
@@ -0,0 +1,647 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lockstep.h"
+#include "chip8_ops.h"
+
+// Each cycle the lanes are split into groups that share a pc, up to MAX_GROUPS of them run together and the
+// lanes left after that run one at a time. A group only runs together when its instruction is in
+// lockstep_groupable, calls, returns and key tests run one lane at a time on the arrays and everything else
+// goes through chip8_execute on the lane's own CHIP8, which holds the lane's memory, screen and random numbers
+// Lanes decode the rom they were all loaded with, a lane that wrote to memory runs the code it wrote over by itself
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LOCKSTEP_AVX2
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+#define LANE_BLOCK 32 // Lanes in an AVX2 register of bytes, every per lane array is padded to a multiple of it
+#define MAX_GROUPS 4
+
+typedef struct lockstep
+{
+    int lanes;
+    int stride;               // lanes rounded up to LANE_BLOCK, the length of every per lane array
+    unsigned char* block;     // Single allocation holding the arrays below
+    unsigned char* V;         // Register r of lane l is V[r * stride + l]
+    unsigned short* pc;
+    unsigned short* I;
+    unsigned short* sp;
+    unsigned short* stack;    // Laid out like V, the lanes' CHIP8s only get a copy in lockstep_sync_lane
+    unsigned char* key;       // Laid out like V, also set in the lanes' CHIP8s for FX0A
+    unsigned char* delay_timer;
+    unsigned char* sound_timer;
+    short* written_low;       // Each lane wrote somewhere in [written_low, written_high) of its memory
+    short* written_high;
+    unsigned char* pending;   // 0xFF for lanes that have not run this cycle yet
+    unsigned char* mask;      // 0xFF for lanes in the group being run
+    Chip8** machines;
+    uint64_t cycles;
+    int tick_cycles_left;
+    int cycles_per_tick;
+    Boolean vector;
+    uint64_t grouped_steps;   // Lane instructions run together with other lanes
+    uint64_t lane_steps;      // Lane instructions run one lane at a time
+    uint64_t groups;
+    Instruction code[MEMORY_SIZE];    // Decoded from image when first run
+    unsigned char image[MEMORY_SIZE]; // Memory every lane started with
+} Lockstep;
+
+static Boolean lockstep_has_avx2(void)
+{
+#ifdef LOCKSTEP_AVX2
+    return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+#else
+    return FALSE;
+#endif
+}
+
+// Instructions that only read and write V, pc, I and the timers
+static Boolean lockstep_groupable(unsigned char op)
+{
+    switch (op)
+    {
+    case OP_1NNN: case OP_IDLE: case OP_3XNN: case OP_4XNN: case OP_5XY0: case OP_6XNN: case OP_7XNN:
+    case OP_8XY0: case OP_8XY1: case OP_8XY2: case OP_8XY3: case OP_8XY4: case OP_8XY5: case OP_8XY6:
+    case OP_8XY7: case OP_8XYE: case OP_9XY0: case OP_ANNN: case OP_FX07: case OP_FX15: case OP_FX18:
+    case OP_FX1E: case OP_FX29:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+// TRUE when the instruction at pc may differ from the rom in the lane's memory
+static Boolean lockstep_is_private(Lockstep* pLockstep, int lane, unsigned short pc)
+{
+    return pc >= MEMORY_SIZE - 1 || (pLockstep->written_low[lane] <= pc + 1 && pLockstep->written_high[lane] > pc);
+}
+
+static void lockstep_note_write(Lockstep* pLockstep, int lane, int address, int length)
+{
+    // Writes that wrap around the end of memory count as writing all of it
+    int end = address + length;
+    if (end > MEMORY_SIZE)
+    {
+        address = 0;
+        end = MEMORY_SIZE;
+    }
+    if (address < pLockstep->written_low[lane])
+        pLockstep->written_low[lane] = (short)address;
+    if (end > pLockstep->written_high[lane])
+        pLockstep->written_high[lane] = (short)end;
+}
+
+// Decoded instruction at pc for a lane that runs the rom's code there
+static const Instruction* lockstep_code(Lockstep* pLockstep, unsigned short pc)
+{
+    Instruction* pInstruction = &pLockstep->code[pc];
+    if (pInstruction->op == OP_UNDECODED)
+        chip8_decode(pLockstep->image[pc] << 8 | pLockstep->image[pc + 1], pInstruction);
+    return pInstruction;
+}
+
+// Copies the registers an instruction can use between the lane's arrays and its CHIP8, the rest are left stale
+// in the CHIP8. V0 to VX for FX55 and FX65, otherwise V0 for BNNN, VX, VY and VF
+static void lockstep_copy_registers(Lockstep* pLockstep, int lane, const Instruction* pInstruction, Boolean in)
+{
+    Chip8* pChip8 = pLockstep->machines[lane];
+    unsigned char* V = pLockstep->V + lane;
+    int stride = pLockstep->stride;
+    int last = pInstruction->op == OP_FX55 || pInstruction->op == OP_FX65 ? pInstruction->x : 0;
+    int used[] = {pInstruction->x, pInstruction->y, 0xF};
+    for (int r = 0; r <= last; r++)
+    {
+        if (in)
+            pChip8->V[r] = V[r * stride];
+        else
+            V[r * stride] = pChip8->V[r];
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        if (in)
+            pChip8->V[used[i]] = V[used[i] * stride];
+        else
+            V[used[i] * stride] = pChip8->V[used[i]];
+    }
+}
+
+// Runs subroutine calls and key tests straight on the lane's arrays, FALSE for every other instruction
+// An sp or key number out of range wraps around instead of indexing past the arrays
+static Boolean lockstep_run_on_arrays(Lockstep* pLockstep, int lane, const Instruction* pInstruction)
+{
+    int stride = pLockstep->stride;
+    unsigned short* pPc = &pLockstep->pc[lane];
+    unsigned short* pSp = &pLockstep->sp[lane];
+    int key = pLockstep->V[pInstruction->x * stride + lane] & (NUM_OF_KEYS - 1);
+    switch (pInstruction->op)
+    {
+    case OP_2NNN:
+        pLockstep->stack[(*pSp & (STACK_SIZE - 1)) * stride + lane] = *pPc;
+        (*pSp)++;
+        *pPc = pInstruction->nnn;
+        return TRUE;
+    case OP_00EE:
+        (*pSp)--;
+        *pPc = pLockstep->stack[(*pSp & (STACK_SIZE - 1)) * stride + lane] + 2;
+        return TRUE;
+    case OP_EX9E:
+        *pPc += pLockstep->key[key * stride + lane] != 0 ? 4 : 2;
+        return TRUE;
+    case OP_EXA1:
+        *pPc += pLockstep->key[key * stride + lane] == 0 ? 4 : 2;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+// Runs the instruction at the lane's pc on its CHIP8, the lane's registers are copied in and back out around it
+// pInstruction is the rom's instruction at pc, or NULL for lanes that need their own memory decoded
+static void lockstep_run_lane(Lockstep* pLockstep, int lane, const Instruction* pInstruction)
+{
+    Chip8* pChip8 = pLockstep->machines[lane];
+    if (pInstruction == NULL)
+        pInstruction = chip8_fetch(pChip8, pLockstep->pc[lane]);
+    pLockstep->lane_steps++;
+    if (lockstep_run_on_arrays(pLockstep, lane, pInstruction))
+        return;
+
+    pChip8->pc = pLockstep->pc[lane];
+    pChip8->I = pLockstep->I[lane];
+    pChip8->delay_timer = pLockstep->delay_timer[lane];
+    pChip8->sound_timer = pLockstep->sound_timer[lane];
+    lockstep_copy_registers(pLockstep, lane, pInstruction, TRUE);
+
+    if (pInstruction->op == OP_FX33)
+        lockstep_note_write(pLockstep, lane, pChip8->I, 3);
+    else if (pInstruction->op == OP_FX55)
+        lockstep_note_write(pLockstep, lane, pChip8->I, pInstruction->x + 1);
+    chip8_execute(pChip8, pInstruction);
+    pChip8->events = 0;
+
+    lockstep_copy_registers(pLockstep, lane, pInstruction, FALSE);
+    pLockstep->pc[lane] = pChip8->pc;
+    pLockstep->I[lane] = pChip8->I;
+    pLockstep->delay_timer[lane] = pChip8->delay_timer;
+    pLockstep->sound_timer[lane] = pChip8->sound_timer;
+}
+
+// Runs a lane by itself, lanes at code they did not write over share the rom's decoded instructions
+static void lockstep_run_alone(Lockstep* pLockstep, int lane)
+{
+    unsigned short pc = pLockstep->pc[lane];
+    lockstep_run_lane(pLockstep, lane, lockstep_is_private(pLockstep, lane, pc) ? NULL : lockstep_code(pLockstep, pc));
+}
+
+#ifdef LOCKSTEP_AVX2
+
+// Stores value into the lanes of a byte array that are set in mask
+AVX2 static inline void lockstep_blend8(unsigned char* array, __m256i mask, __m256i value)
+{
+    __m256i old = _mm256_load_si256((const __m256i*)array);
+    _mm256_store_si256((__m256i*)array, _mm256_blendv_epi8(old, value, mask));
+}
+
+// Stores low and high into the first and last 16 lanes of a short array that are set in the byte mask
+AVX2 static inline void lockstep_blend16(unsigned short* array, __m256i mask, __m256i low, __m256i high)
+{
+    __m256i mask_low = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask));
+    __m256i mask_high = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask, 1));
+    __m256i old_low = _mm256_load_si256((const __m256i*)array);
+    __m256i old_high = _mm256_load_si256((const __m256i*)(array + 16));
+    _mm256_store_si256((__m256i*)array, _mm256_blendv_epi8(old_low, low, mask_low));
+    _mm256_store_si256((__m256i*)(array + 16), _mm256_blendv_epi8(old_high, high, mask_high));
+}
+
+// Adds the byte per lane in value to a short array for the lanes set in mask
+AVX2 static inline void lockstep_add16(unsigned short* array, __m256i mask, __m256i value)
+{
+    value = _mm256_and_si256(value, mask);
+    __m256i low = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(value));
+    __m256i high = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(value, 1));
+    _mm256_store_si256((__m256i*)array, _mm256_add_epi16(_mm256_load_si256((const __m256i*)array), low));
+    _mm256_store_si256((__m256i*)(array + 16),
+                       _mm256_add_epi16(_mm256_load_si256((const __m256i*)(array + 16)), high));
+}
+
+// Builds the mask of pending lanes at pc that run the rom's code there and takes them off pending
+AVX2 static int lockstep_select_avx2(Lockstep* pLockstep, unsigned short pc)
+{
+    const __m256i target = _mm256_set1_epi16((short)pc);
+    const __m256i target_end = _mm256_set1_epi16((short)(pc + 1));
+    int count = 0;
+    for (int lane = 0; lane < pLockstep->stride; lane += LANE_BLOCK)
+    {
+        __m256i half[2];
+        for (int h = 0; h < 2; h++)
+        {
+            int i = lane + h * 16;
+            __m256i at = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)(pLockstep->pc + i)), target);
+            __m256i low = _mm256_load_si256((const __m256i*)(pLockstep->written_low + i));
+            __m256i high = _mm256_load_si256((const __m256i*)(pLockstep->written_high + i));
+            __m256i written = _mm256_andnot_si256(_mm256_cmpgt_epi16(low, target_end), _mm256_cmpgt_epi16(high, target));
+            half[h] = _mm256_andnot_si256(written, at);
+        }
+        // packs works within each 128 bit half, the permute puts the lanes back in order
+        __m256i mask = _mm256_permute4x64_epi64(_mm256_packs_epi16(half[0], half[1]), 0xD8);
+        __m256i pending = _mm256_load_si256((const __m256i*)(pLockstep->pending + lane));
+        mask = _mm256_and_si256(mask, pending);
+        _mm256_store_si256((__m256i*)(pLockstep->mask + lane), mask);
+        _mm256_store_si256((__m256i*)(pLockstep->pending + lane), _mm256_andnot_si256(mask, pending));
+        count += __builtin_popcount((unsigned int)_mm256_movemask_epi8(mask));
+    }
+    return count;
+}
+
+// Runs a groupable instruction for every lane in the mask, the same as the chip8_op_ functions one lane at a time
+AVX2 static void lockstep_run_group_avx2(Lockstep* pLockstep, const Instruction* pInstruction)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    const __m256i nn = _mm256_set1_epi8((char)pInstruction->nn);
+    const __m256i nnn = _mm256_set1_epi16((short)pInstruction->nnn);
+    unsigned char* rx = pLockstep->V + pInstruction->x * pLockstep->stride;
+    unsigned char* ry = pLockstep->V + pInstruction->y * pLockstep->stride;
+    unsigned char* rf = pLockstep->V + 0xF * pLockstep->stride;
+
+    for (int lane = 0; lane < pLockstep->stride; lane += LANE_BLOCK)
+    {
+        __m256i mask = _mm256_load_si256((const __m256i*)(pLockstep->mask + lane));
+        if (_mm256_testz_si256(mask, mask))
+            continue;
+        __m256i vx = _mm256_load_si256((const __m256i*)(rx + lane));
+        __m256i vy = _mm256_load_si256((const __m256i*)(ry + lane));
+        __m256i step = two;
+        __m256i flag;
+
+        // VF is written before or after VX in the same order as the scalar opcode, and the shifts that write VF
+        // first shift the flag when VF is X, so VF as X gives the same result
+        switch (pInstruction->op)
+        {
+        case OP_1NNN:
+        case OP_IDLE:
+            lockstep_blend16(pLockstep->pc + lane, mask, nnn, nnn);
+            continue;
+        case OP_3XNN: step = _mm256_add_epi8(two, _mm256_and_si256(_mm256_cmpeq_epi8(vx, nn), two)); break;
+        case OP_4XNN: step = _mm256_add_epi8(two, _mm256_andnot_si256(_mm256_cmpeq_epi8(vx, nn), two)); break;
+        case OP_5XY0: step = _mm256_add_epi8(two, _mm256_and_si256(_mm256_cmpeq_epi8(vx, vy), two)); break;
+        case OP_9XY0: step = _mm256_add_epi8(two, _mm256_andnot_si256(_mm256_cmpeq_epi8(vx, vy), two)); break;
+        case OP_6XNN: lockstep_blend8(rx + lane, mask, nn); break;
+        case OP_7XNN: lockstep_blend8(rx + lane, mask, _mm256_add_epi8(vx, nn)); break;
+        case OP_8XY0: lockstep_blend8(rx + lane, mask, vy); break;
+        case OP_8XY1:
+            lockstep_blend8(rx + lane, mask, _mm256_or_si256(vx, vy));
+            lockstep_blend8(rf + lane, mask, zero);
+            break;
+        case OP_8XY2:
+            lockstep_blend8(rx + lane, mask, _mm256_and_si256(vx, vy));
+            lockstep_blend8(rf + lane, mask, zero);
+            break;
+        case OP_8XY3:
+            lockstep_blend8(rx + lane, mask, _mm256_xor_si256(vx, vy));
+            lockstep_blend8(rf + lane, mask, zero);
+            break;
+        case OP_8XY4:
+            {
+                // The sum carried when saturating it gives a different result
+                __m256i sum = _mm256_add_epi8(vx, vy);
+                flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(vx, vy), sum), one);
+                lockstep_blend8(rx + lane, mask, sum);
+                lockstep_blend8(rf + lane, mask, flag);
+            }
+            break;
+        case OP_8XY5:
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vx), one);
+            lockstep_blend8(rx + lane, mask, _mm256_sub_epi8(vx, vy));
+            lockstep_blend8(rf + lane, mask, flag);
+            break;
+        case OP_8XY6:
+            lockstep_blend8(rf + lane, mask, _mm256_and_si256(vx, one));
+            if (pInstruction->x == 0xF)
+                vx = _mm256_load_si256((const __m256i*)(rf + lane));
+            lockstep_blend8(rx + lane, mask, _mm256_and_si256(_mm256_srli_epi16(vx, 1), _mm256_set1_epi8(0x7F)));
+            break;
+        case OP_8XY7:
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vy), one);
+            lockstep_blend8(rx + lane, mask, _mm256_sub_epi8(vy, vx));
+            lockstep_blend8(rf + lane, mask, flag);
+            break;
+        case OP_8XYE:
+            lockstep_blend8(rf + lane, mask, _mm256_and_si256(_mm256_srli_epi16(vx, 7), one));
+            if (pInstruction->x == 0xF)
+                vx = _mm256_load_si256((const __m256i*)(rf + lane));
+            lockstep_blend8(rx + lane, mask, _mm256_add_epi8(vx, vx));
+            break;
+        case OP_ANNN: lockstep_blend16(pLockstep->I + lane, mask, nnn, nnn); break;
+        case OP_FX07: lockstep_blend8(rx + lane, mask, _mm256_load_si256((const __m256i*)(pLockstep->delay_timer + lane))); break;
+        case OP_FX15: lockstep_blend8(pLockstep->delay_timer + lane, mask, vx); break;
+        case OP_FX18: lockstep_blend8(pLockstep->sound_timer + lane, mask, vx); break;
+        case OP_FX1E: lockstep_add16(pLockstep->I + lane, mask, vx); break;
+        case OP_FX29:
+            {
+                const __m256i five = _mm256_set1_epi16(5);
+                __m256i low = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(vx)), five);
+                __m256i high = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(vx, 1)), five);
+                lockstep_blend16(pLockstep->I + lane, mask, low, high);
+            }
+            break;
+        }
+        lockstep_add16(pLockstep->pc + lane, mask, step);
+    }
+}
+
+AVX2 static void lockstep_tick_avx2(Lockstep* pLockstep)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    for (int lane = 0; lane < pLockstep->stride; lane += LANE_BLOCK)
+    {
+        __m256i* pDelay = (__m256i*)(pLockstep->delay_timer + lane);
+        __m256i* pSound = (__m256i*)(pLockstep->sound_timer + lane);
+        _mm256_store_si256(pDelay, _mm256_subs_epu8(_mm256_load_si256(pDelay), one));
+        _mm256_store_si256(pSound, _mm256_subs_epu8(_mm256_load_si256(pSound), one));
+    }
+}
+
+// One cycle of every lane, grouped lanes first and then the ones left over
+static void lockstep_step_vector(Lockstep* pLockstep)
+{
+    memset(pLockstep->pending, 0xFF, pLockstep->lanes);
+    int next = 0;
+    for (int group = 0; group < MAX_GROUPS; group++)
+    {
+        while (next < pLockstep->lanes && !pLockstep->pending[next])
+            next++;
+        if (next == pLockstep->lanes)
+            break;
+
+        unsigned short pc = pLockstep->pc[next];
+        if (lockstep_is_private(pLockstep, next, pc))
+        {
+            pLockstep->pending[next] = 0;
+            lockstep_run_lane(pLockstep, next, NULL);
+            continue;
+        }
+        const Instruction* pInstruction = lockstep_code(pLockstep, pc);
+
+        int count = lockstep_select_avx2(pLockstep, pc);
+        if (lockstep_groupable(pInstruction->op))
+        {
+            lockstep_run_group_avx2(pLockstep, pInstruction);
+            pLockstep->grouped_steps += count;
+            pLockstep->groups++;
+        }
+        else
+        {
+            for (int lane = next; lane < pLockstep->lanes; lane++)
+            {
+                if (pLockstep->mask[lane])
+                    lockstep_run_lane(pLockstep, lane, pInstruction);
+            }
+        }
+    }
+    for (int lane = next; lane < pLockstep->lanes; lane++)
+    {
+        if (pLockstep->pending[lane])
+            lockstep_run_alone(pLockstep, lane);
+    }
+
+    pLockstep->cycles++;
+    if (--pLockstep->tick_cycles_left == 0)
+    {
+        pLockstep->tick_cycles_left = pLockstep->cycles_per_tick;
+        lockstep_tick_avx2(pLockstep);
+    }
+}
+
+#endif
+
+// One cycle of every lane, each lane on its own
+static void lockstep_step_scalar(Lockstep* pLockstep)
+{
+    for (int lane = 0; lane < pLockstep->lanes; lane++)
+        lockstep_run_alone(pLockstep, lane);
+
+    pLockstep->cycles++;
+    if (--pLockstep->tick_cycles_left == 0)
+    {
+        pLockstep->tick_cycles_left = pLockstep->cycles_per_tick;
+        for (int lane = 0; lane < pLockstep->lanes; lane++)
+        {
+            if (pLockstep->delay_timer[lane] > 0)
+                pLockstep->delay_timer[lane]--;
+            if (pLockstep->sound_timer[lane] > 0)
+                pLockstep->sound_timer[lane]--;
+        }
+    }
+}
+
+// Copies the memory every lane starts with out of the first lane
+static void lockstep_read_image(Lockstep* pLockstep)
+{
+    for (int address = 0; address < MEMORY_SIZE; address++)
+        pLockstep->image[address] = chip8_read(pLockstep->machines[0], address);
+}
+
+LOCKSTEP lockstep_init_default(int lanes)
+{
+    if (lanes <= 0)
+        return NULL;
+    Lockstep* pLockstep = (Lockstep*)calloc(1, sizeof(Lockstep));
+    if (pLockstep == NULL)
+        return NULL;
+    pLockstep->lanes = lanes;
+    pLockstep->stride = (lanes + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK;
+    pLockstep->cycles_per_tick = CYCLES_PER_FRAME;
+    pLockstep->tick_cycles_left = CYCLES_PER_FRAME;
+    pLockstep->vector = lockstep_has_avx2();
+
+    // Every array is a whole number of LANE_BLOCK sized blocks so they all stay aligned
+    int stride = pLockstep->stride;
+    size_t bytes = (size_t)stride * ((3 + STACK_SIZE) * sizeof(unsigned short) + 2 * sizeof(short) + CPU_REGISTERS + NUM_OF_KEYS + 4);
+#ifdef _WIN32
+    pLockstep->block = (unsigned char*)_aligned_malloc(bytes, LANE_BLOCK);
+#else
+    pLockstep->block = (unsigned char*)aligned_alloc(LANE_BLOCK, bytes);
+#endif
+    pLockstep->machines = (Chip8**)calloc(lanes, sizeof(Chip8*));
+    if (pLockstep->block == NULL || pLockstep->machines == NULL)
+    {
+        lockstep_destroy((LOCKSTEP*)&pLockstep);
+        return NULL;
+    }
+    memset(pLockstep->block, 0, bytes);
+    pLockstep->pc = (unsigned short*)pLockstep->block;
+    pLockstep->I = pLockstep->pc + stride;
+    pLockstep->sp = pLockstep->I + stride;
+    pLockstep->stack = pLockstep->sp + stride;
+    pLockstep->written_low = (short*)(pLockstep->stack + STACK_SIZE * stride);
+    pLockstep->written_high = pLockstep->written_low + stride;
+    pLockstep->V = (unsigned char*)(pLockstep->written_high + stride);
+    pLockstep->key = pLockstep->V + CPU_REGISTERS * stride;
+    pLockstep->delay_timer = pLockstep->key + NUM_OF_KEYS * stride;
+    pLockstep->sound_timer = pLockstep->delay_timer + stride;
+    pLockstep->pending = pLockstep->sound_timer + stride;
+    pLockstep->mask = pLockstep->pending + stride;
+
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        pLockstep->machines[lane] = (Chip8*)chip8_init_default();
+        if (pLockstep->machines[lane] == NULL)
+        {
+            lockstep_destroy((LOCKSTEP*)&pLockstep);
+            return NULL;
+        }
+        // Stuck lanes would print the same opcode every cycle, chip8_get_state_hash still shows them
+        pLockstep->machines[lane]->report_unknown = FALSE;
+        pLockstep->pc[lane] = pLockstep->machines[lane]->pc;
+        pLockstep->written_low[lane] = MEMORY_SIZE;
+    }
+    lockstep_read_image(pLockstep);
+    return pLockstep;
+}
+
+Status lockstep_load_rom(LOCKSTEP hLockstep, FILE* fp)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    Chip8* pFirst = pLockstep->machines[0];
+    if (chip8_load_rom(pFirst, fp) == FAILURE)
+        return FAILURE;
+    lockstep_read_image(pLockstep);
+    memset(pLockstep->code, 0, sizeof(pLockstep->code));
+    for (int lane = 0; lane < pLockstep->lanes; lane++)
+    {
+        if (lane > 0)
+            chip8_share_rom(pLockstep->machines[lane], pFirst);
+        pLockstep->written_low[lane] = MEMORY_SIZE;
+        pLockstep->written_high[lane] = 0;
+    }
+    return SUCCESS;
+}
+
+int lockstep_get_lanes(LOCKSTEP hLockstep)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    return pLockstep->lanes;
+}
+
+void lockstep_seed(LOCKSTEP hLockstep, int lane, uint64_t seed)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    chip8_seed(pLockstep->machines[lane], seed);
+}
+
+void lockstep_set_key(LOCKSTEP hLockstep, int lane, int key_index, int state)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    pLockstep->key[key_index * pLockstep->stride + lane] = (unsigned char)state;
+    chip8_set_key(pLockstep->machines[lane], key_index, state);
+}
+
+// Same rounding as chip8_set_ips
+void lockstep_set_ips(LOCKSTEP hLockstep, int ips)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    int cycles = ips / FRAME_RATE > 0 ? ips / FRAME_RATE : 1;
+    pLockstep->cycles_per_tick = cycles;
+    if (pLockstep->tick_cycles_left > cycles)
+        pLockstep->tick_cycles_left = cycles;
+    for (int lane = 0; lane < pLockstep->lanes; lane++)
+        chip8_set_ips(pLockstep->machines[lane], ips);
+}
+
+Status lockstep_set_vector(LOCKSTEP hLockstep, Boolean enabled)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    if (enabled && !lockstep_has_avx2())
+        return FAILURE;
+    pLockstep->vector = enabled;
+    return SUCCESS;
+}
+
+void lockstep_run_cycles(LOCKSTEP hLockstep, int cycles)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+#ifdef LOCKSTEP_AVX2
+    if (pLockstep->vector)
+    {
+        for (int i = 0; i < cycles; i++)
+            lockstep_step_vector(pLockstep);
+        return;
+    }
+#endif
+    for (int i = 0; i < cycles; i++)
+        lockstep_step_scalar(pLockstep);
+}
+
+uint64_t lockstep_get_cycles(LOCKSTEP hLockstep)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    return pLockstep->cycles;
+}
+
+// Copies the lane's arrays and the shared clock into its CHIP8 so it holds the lane's whole state
+static Chip8* lockstep_sync_lane(Lockstep* pLockstep, int lane)
+{
+    Chip8* pChip8 = pLockstep->machines[lane];
+    for (int r = 0; r < CPU_REGISTERS; r++)
+        pChip8->V[r] = pLockstep->V[r * pLockstep->stride + lane];
+    pChip8->pc = pLockstep->pc[lane];
+    pChip8->I = pLockstep->I[lane];
+    pChip8->delay_timer = pLockstep->delay_timer[lane];
+    pChip8->sound_timer = pLockstep->sound_timer[lane];
+    pChip8->sp = pLockstep->sp[lane];
+    for (int i = 0; i < STACK_SIZE; i++)
+        pChip8->stack[i] = pLockstep->stack[i * pLockstep->stride + lane];
+    pChip8->cycles = pLockstep->cycles;
+    pChip8->tick_cycles_left = pLockstep->tick_cycles_left;
+    pChip8->cycles_per_tick = pLockstep->cycles_per_tick;
+    return pChip8;
+}
+
+uint32_t lockstep_get_state_hash(LOCKSTEP hLockstep, int lane)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    return chip8_get_state_hash(lockstep_sync_lane(pLockstep, lane));
+}
+
+uint64_t lockstep_get_screen_hash(LOCKSTEP hLockstep, int lane)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    return chip8_get_screen_hash(pLockstep->machines[lane]);
+}
+
+void lockstep_print_stats(LOCKSTEP hLockstep)
+{
+    Lockstep* pLockstep = (Lockstep*)hLockstep;
+    uint64_t total = pLockstep->grouped_steps + pLockstep->lane_steps;
+    if (total == 0)
+        return;
+    printf("Lockstep: %d lanes, %.1f%% of lane instructions ran grouped (%.1f lanes per group), AVX2 %s\n",
+           pLockstep->lanes, 100.0 * pLockstep->grouped_steps / total,
+           pLockstep->groups > 0 ? (double)pLockstep->grouped_steps / pLockstep->groups : 0.0,
+           pLockstep->vector ? "on" : "off");
+}
+
+void lockstep_destroy(LOCKSTEP* phLockstep)
+{
+    Lockstep* pLockstep = (Lockstep*)*phLockstep;
+    if (pLockstep->machines != NULL)
+    {
+        for (int lane = 0; lane < pLockstep->lanes; lane++)
+        {
+            if (pLockstep->machines[lane] != NULL)
+                chip8_destory((CHIP8*)&pLockstep->machines[lane]);
+        }
+    }
+    free(pLockstep->machines);
+#ifdef _WIN32
+    _aligned_free(pLockstep->block);
+#else
+    free(pLockstep->block);
+#endif
+    free(pLockstep);
+    *phLockstep = NULL;
+}
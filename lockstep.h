@@ -0,0 +1,35 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdio.h>
+#include "chip8.h"
+
+// Many copies of one ROM run side by side, one lane per copy, for fuzzing and search workloads where only the
+// input and seed differ between runs
+// V, pc, I and the timers are held as one array per field with a slot per lane, so lanes at the same pc run
+// register, jump and skip instructions together with AVX2 when the CPU has it. Lanes that went their own way,
+// and instructions that touch memory, the screen, keys, the stack or the random numbers, run one lane at a time
+// Every lane executes one instruction per cycle and ends up in the same state a CHIP8 would after as many cycles
+
+typedef void* LOCKSTEP;
+
+LOCKSTEP lockstep_init_default(int lanes);
+// Loads the same rom into every lane
+Status lockstep_load_rom(LOCKSTEP hLockstep, FILE* fp);
+int lockstep_get_lanes(LOCKSTEP hLockstep);
+void lockstep_seed(LOCKSTEP hLockstep, int lane, uint64_t seed);
+void lockstep_set_key(LOCKSTEP hLockstep, int lane, int key_index, int state);
+void lockstep_set_ips(LOCKSTEP hLockstep, int ips);
+// Lanes start out grouped when the CPU has AVX2, FAILURE when it is asked for on a CPU without it
+Status lockstep_set_vector(LOCKSTEP hLockstep, Boolean enabled);
+// Runs every lane for cycles instructions
+void lockstep_run_cycles(LOCKSTEP hLockstep, int cycles);
+uint64_t lockstep_get_cycles(LOCKSTEP hLockstep);
+// Same as chip8_get_state_hash and chip8_get_screen_hash for a CHIP8 in the lane's state
+uint32_t lockstep_get_state_hash(LOCKSTEP hLockstep, int lane);
+uint64_t lockstep_get_screen_hash(LOCKSTEP hLockstep, int lane);
+// Prints how many lane instructions ran in groups and how large the groups were
+void lockstep_print_stats(LOCKSTEP hLockstep);
+void lockstep_destroy(LOCKSTEP* phLockstep);
+
+#endif
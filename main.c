@@ -4,70 +4,183 @@
 #include <string.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "chip8.h"
-#include <windows.h>
+#include "triple_buffer.h"
+#include "pacer.h"
+#include "input_queue.h"
+#include "audio.h"
+#include "rewind.h"
+#include "input_log.h"
 
 unsigned int create_shader(const char* vertex_shader, const char* fragment_shader);
 unsigned int compile_shader(unsigned int type, const char* source);
-void draw_frame(unsigned char* gfx, int window_width, int window_height);
-void handle_keys(GLFWwindow* window, Boolean* exit_flag);
-void sleep(unsigned int mseconds);
+
+// Everything the render and emulation threads share, passed to the emulation thread and the key callback
+// instead of living in globals
+typedef struct emulator
+{
+    CHIP8 hChip8;
+    TRIPLE_BUFFER hFrames; // Frames from the emulation thread to the render thread
+    INPUT_QUEUE hInput;    // Key events from the render thread to the emulation thread
+    AUDIO hAudio;
+    REWIND hRewind;
+    INPUT_LOG hLog;        // Key events are recorded here with --record
+    atomic_int running;
+    atomic_int rewinding;  // Backspace is held
+    atomic_int debug;      // P was pressed, the emulation thread is in the debugger until it is left
+    Boolean debug_enabled;
+} Emulator;
+
+Boolean draw_frame(uint64_t* presented, const uint64_t* gfx, uint32_t dirty_rows);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void* emulate(void* arg);
+void publish_frame(Emulator* pEmulator, unsigned int sequence);
 
 
-CHIP8 hChip8;
-Boolean debug;
-Boolean debug_enabled;
+// Keyboard key for each CHIP8 key, indexed by the CHIP8 key
+const int key_map[NUM_OF_KEYS] =
+{
+    GLFW_KEY_X, GLFW_KEY_1, GLFW_KEY_2, GLFW_KEY_3,
+    GLFW_KEY_Q, GLFW_KEY_W, GLFW_KEY_E, GLFW_KEY_A,
+    GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_Z, GLFW_KEY_C,
+    GLFW_KEY_4, GLFW_KEY_R, GLFW_KEY_F, GLFW_KEY_V
+};
 
 int main(int argc, char* argv[])
 {
+    Emulator emulator;
+    memset(&emulator, 0, sizeof(emulator));
     if (argc < 2)
     {
         printf("Program Usage: CHIP8_EMU <rom_path>\n");
         exit(1);
     }
 
-    debug_enabled = FALSE;
+    Boolean jit_enabled = FALSE;
+    Boolean threaded_enabled = FALSE;
     int size_modifer = 10;
-    if (argc > 2)
+    int instructions_per_second = FRAME_RATE * CYCLES_PER_FRAME;
+    const char* wav_path = NULL;
+    Boolean mute = FALSE;
+    uint64_t seed = (uint64_t)time(NULL);
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    const char* profile_path = NULL;
+    for (int i = 2; i < argc; i++)
     {
-        if (!strcmp(argv[2], "--debug") || !strcmp(argv[3], "--debug"))
+        if (!strcmp(argv[i], "--debug"))
         {
             printf("Program launched with debug enabled press P to start debugging!\n");
-            debug_enabled = TRUE;
+            emulator.debug_enabled = TRUE;
         }
+        else if (!strcmp(argv[i], "--jit"))
+            jit_enabled = TRUE;
+        else if (!strcmp(argv[i], "--threaded"))
+            threaded_enabled = TRUE;
+        else if (!strcmp(argv[i], "--ips") && i + 1 < argc)
+            instructions_per_second = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--wav") && i + 1 < argc)
+            wav_path = argv[++i];
+        else if (!strcmp(argv[i], "--mute"))
+            mute = TRUE;
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            record_path = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+            profile_path = argv[++i];
     }
 
-    Boolean exit_flag = FALSE;
-    
-    srand(time(NULL));
-
     // Initialize the chip8 system and load the program into memory
-    hChip8 = chip8_init_default();
-    if (hChip8 == NULL)
+    emulator.hChip8 = chip8_init_default();
+    if (emulator.hChip8 == NULL)
     {
         printf("Failed to allocate memory a Chip8 Object!\n");
         exit(1);
     }
-    FILE* fp = fopen(argv[1], "rb");
-    if (fp == NULL)
+    Status load_status = chip8_load_rom_file(emulator.hChip8, argv[1]);
+    if (load_status == FAILURE)
     {
-        printf("Rom does not exist or failed to read!\n");
+        printf("Rom does not exist or failed to load!\n");
         exit(1);
     }
-    Status load_status = chip8_load_rom(hChip8, fp);
-    if (load_status == FAILURE)
+    if (jit_enabled && chip8_set_core(emulator.hChip8, CORE_JIT) == FAILURE)
+        printf("JIT is not available in this build, using the interpreter!\n");
+    if (threaded_enabled && chip8_set_core(emulator.hChip8, CORE_THREADED) == FAILURE)
+        printf("Threaded core is not available in this build, using the interpreter!\n");
+    chip8_set_ips(emulator.hChip8, instructions_per_second);
+    chip8_seed(emulator.hChip8, seed);
+    if (profile_path != NULL && chip8_set_profiling(emulator.hChip8, TRUE) == FAILURE)
+    {
+        printf("The profiler is not available in this build, configure with -DCHIP8_PROFILE=ON!\n");
+        profile_path = NULL;
+    }
+
+    // Replays run without a window as fast as they can
+    if (replay_path != NULL)
+    {
+        INPUT_LOG hReplay = input_log_open(replay_path);
+        if (hReplay == NULL)
+        {
+            printf("Failed to open the input log %s!\n", replay_path);
+            exit(1);
+        }
+        clock_t start = clock();
+        Status replay_status = input_log_replay(hReplay, emulator.hChip8);
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("Replayed %llu cycles in %.3f s, state hash %08x\n", (unsigned long long)chip8_get_cycles(emulator.hChip8), seconds,
+               chip8_get_state_hash(emulator.hChip8));
+        if (replay_status == FAILURE)
+            printf("The replay did not line up with the log, it was cut short or recorded with another rom or build!\n");
+        input_log_close(&hReplay);
+        if (profile_path != NULL && chip8_write_profile_file(emulator.hChip8, profile_path) == FAILURE)
+            printf("Failed to write the profile to %s!\n", profile_path);
+        chip8_destory(&emulator.hChip8);
+        return replay_status == SUCCESS ? 0 : 1;
+    }
+    if (record_path != NULL)
     {
-        printf("Failed to load rom!\n");
+        emulator.hLog = input_log_create(record_path, seed, chip8_get_ips(emulator.hChip8));
+        if (emulator.hLog == NULL)
+        {
+            printf("Failed to create the input log %s!\n", record_path);
+            exit(1);
+        }
+    }
+
+    // Sound goes to a WAV file with --wav, otherwise to the sound card when the build has one
+    const AudioSink* pSink = &audio_sink_null;
+    if (wav_path != NULL)
+        pSink = &audio_sink_wav;
+    else if (mute)
+        pSink = &audio_sink_null;
+#ifdef CHIP8_HAVE_ALSA
+    else
+        pSink = &audio_sink_alsa;
+#endif
+    emulator.hAudio = audio_init_default(pSink, wav_path, chip8_get_ips(emulator.hChip8));
+    if (emulator.hAudio == NULL && pSink != &audio_sink_null)
+    {
+        printf("Failed to open the %s audio output, continuing without sound!\n", pSink->name);
+        emulator.hAudio = audio_init_default(&audio_sink_null, NULL, chip8_get_ips(emulator.hChip8));
+    }
+    if (emulator.hAudio == NULL)
+    {
+        printf("Failed to start the audio output!\n");
         exit(1);
     }
-    fclose(fp);
 
     const int WINDOW_WIDTH = SCREEN_WIDTH * size_modifer;
     const int WINDOW_HEIGHT = SCREEN_HEIGHT * size_modifer;
     // Init GLFW and create window
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    // The renderer only needs GL 3.3 so it also runs on software implementations like Mesa's llvmpipe
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
@@ -79,11 +192,15 @@ int main(int argc, char* argv[])
         exit(1);
     }
     glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
 
     // Load Glad and GL
     gladLoadGL();
     glViewport(0, 0, SCREEN_WIDTH * size_modifer, SCREEN_HEIGHT * size_modifer);
 
+    // Fullscreen quad, uploaded once, the fragment shader picks the pixel it covers out of the screen texture
+    float vertices[] = {-1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f};
+    unsigned int elements[] = {0, 1, 2, 2, 3, 0}; // Order of drawing verticies to get the triangle
     unsigned int VAO, VBO, EBO;
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -91,63 +208,219 @@ int main(int argc, char* argv[])
    
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);;
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
 
+    // Screen texture, one RG32UI texel per packed 64 bit row so a frame is a 256 byte upload
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, 1, SCREEN_HEIGHT, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, chip8_get_gfx_packed(emulator.hChip8));
+
     const char* vertex_shader_source = 
     "#version 330 core\n"
-    "layout(location = 0) in vec4 position;\n"
+    "layout(location = 0) in vec2 position;\n"
+    "out vec2 screen_position;\n"
     "void main()\n"
     "{\n"
-    "   gl_Position = position;\n"
+    "   screen_position = (position + 1.0f) * 0.5f;\n"
+    "   gl_Position = vec4(position, 0.0f, 1.0f);\n"
     "}\0";
+    // Rows are uploaded as two little endian words, g holds pixels 0 to 31 and r holds pixels 32 to 63
     const char* fragment_shader_source = 
     "#version 330 core\n"
+    "in vec2 screen_position;\n"
+    "uniform usampler2D screen;\n"
     "layout(location = 0) out vec4 color;\n"
     "void main()\n"
     "{\n"
-    "   color = vec4(1.0f, 1.0f, 1.0f, 1.0f);\n"
+    "   int x = min(int(screen_position.x * 64.0f), 63);\n"
+    "   int y = min(int((1.0f - screen_position.y) * 32.0f), 31);\n"
+    "   uvec2 row = texelFetch(screen, ivec2(0, y), 0).rg;\n"
+    "   uint word = x < 32 ? row.g : row.r;\n"
+    "   float pixel = float((word >> uint(31 - (x & 31))) & 1u);\n"
+    "   color = vec4(pixel, pixel, pixel, 1.0f);\n"
     "}\0";
     unsigned int shader = create_shader(vertex_shader_source, fragment_shader_source);
     glUseProgram(shader);
+    glUniform1i(glGetUniformLocation(shader, "screen"), 0);
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     glfwSwapBuffers(window);
 
-    // Emulation Loop
-    while (!glfwWindowShouldClose(window))
+    emulator.hFrames = triple_buffer_init_default();
+    if (emulator.hFrames == NULL)
+    {
+        printf("Failed to allocate memory for the frame buffers!\n");
+        exit(1);
+    }
+    emulator.hInput = input_queue_init_default(64);
+    if (emulator.hInput == NULL)
     {
-        if (debug)
-            chip8_debug(hChip8, &debug);
-        chip8_emulate_cycle(hChip8);
+        printf("Failed to allocate memory for the input queue!\n");
+        exit(1);
+    }
+    // Five minutes of frames, states average a few hundred bytes so they rarely fill the memory first
+    emulator.hRewind = rewind_init_default(5 * 60 * FRAME_RATE, 16 * 1024 * 1024, FRAME_RATE);
+    if (emulator.hRewind == NULL)
+    {
+        printf("Failed to allocate memory for the rewind buffer!\n");
+        exit(1);
+    }
+    atomic_init(&emulator.rewinding, 0);
+    atomic_init(&emulator.debug, 0);
+    glfwSetWindowUserPointer(window, &emulator);
+    glfwSetKeyCallback(window, key_callback);
 
-        if(chip8_get_draw_flag(hChip8))
+    // Emulation runs on its own thread so waiting on the display never slows it down
+    pthread_t emulation_thread;
+    atomic_init(&emulator.running, 1);
+    if (pthread_create(&emulation_thread, NULL, emulate, &emulator) != 0)
+    {
+        printf("Failed to start the emulation thread!\n");
+        exit(1);
+    }
+
+    // Render Loop, presents the newest frame the emulation thread published
+    uint64_t presented[SCREEN_HEIGHT] = {0}; // Rows as they are in the screen texture
+    unsigned int presented_sequence = 0;
+    while (!glfwWindowShouldClose(window))
+    {
+        const Frame* pFrame = triple_buffer_acquire(emulator.hFrames);
+        Boolean drawn = FALSE;
+        if (pFrame->sequence != presented_sequence)
         {
-            draw_frame(chip8_get_gfx(hChip8), WINDOW_WIDTH, WINDOW_HEIGHT);
-            glfwSwapBuffers(window);
-            chip8_set_draw_flag(hChip8, FALSE);
+            presented_sequence = pFrame->sequence;
+            drawn = draw_frame(presented, pFrame->rows, pFrame->dirty_rows);
         }
-        
-        handle_keys(window, &exit_flag);
-        if (chip8_get_sound_timer(hChip8) == 1)
-            PlaySound("beep.wav", NULL, SND_FILENAME | SND_ASYNC);
-        glfwPollEvents();
-        if (exit_flag)
-            break;
-
-        sleep(2);
+        if (drawn)
+            glfwSwapBuffers(window); // Waits for vsync, only this thread is held up
+
+        // Sleeps until there is input or the emulation thread posts an empty event for a new frame
+        glfwWaitEvents();
     }
 
-    chip8_destory(&hChip8);
+    atomic_store(&emulator.running, 0);
+    pthread_join(emulation_thread, NULL);
+    if (emulator.hLog != NULL)
+    {
+        input_log_finish(emulator.hLog, chip8_get_cycles(emulator.hChip8));
+        printf("Recorded %llu cycles, state hash %08x\n", (unsigned long long)chip8_get_cycles(emulator.hChip8), chip8_get_state_hash(emulator.hChip8));
+        input_log_close(&emulator.hLog);
+    }
+    triple_buffer_destroy(&emulator.hFrames);
+    input_queue_destroy(&emulator.hInput);
+    rewind_destroy(&emulator.hRewind);
+    audio_destroy(&emulator.hAudio);
+    if (profile_path != NULL && chip8_write_profile_file(emulator.hChip8, profile_path) == FAILURE)
+        printf("Failed to write the profile to %s!\n", profile_path);
+    chip8_destory(&emulator.hChip8);
     glDeleteProgram(shader);
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &EBO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteVertexArrays(1, &VAO);
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
 }
 
+// Emulation thread, runs one frame of instructions per tick and publishes the screen whenever it changed
+void* emulate(void* arg)
+{
+    Emulator* pEmulator = (Emulator*)arg;
+    PACER hPacer = pacer_init_default(FRAME_RATE);
+    if (hPacer == NULL)
+    {
+        printf("Failed to allocate memory for the frame pacer!\n");
+        exit(1);
+    }
+
+    unsigned int published_sequence = 0;
+    uint64_t audio_offset = 0; // Audio clock minus the CHIP8 clock, rewinding moves the CHIP8 clock back
+    while (atomic_load(&pEmulator->running))
+    {
+        if (atomic_load(&pEmulator->debug))
+        {
+            Boolean debugging = TRUE;
+            chip8_debug(pEmulator->hChip8, &debugging);
+            atomic_store(&pEmulator->debug, debugging);
+        }
+
+        // Key events that came in during the last frame take effect at the start of this one
+        InputEvent event;
+        while (input_queue_pop(pEmulator->hInput, &event))
+        {
+            // A full queue only happens with the game held up, the key is changed right away instead of dropped.
+            // Recordings only hold events a replay can queue again, so while recording the key is dropped instead
+            uint64_t cycle = chip8_get_cycles(pEmulator->hChip8);
+            if (chip8_queue_key(pEmulator->hChip8, event.key, event.state, cycle) == SUCCESS)
+            {
+                if (pEmulator->hLog != NULL)
+                    input_log_write(pEmulator->hLog, cycle, event.key, event.state);
+            }
+            else if (pEmulator->hLog == NULL)
+                chip8_set_key(pEmulator->hChip8, event.key, event.state);
+        }
+
+        // A recording only holds key events so it cannot follow the game back in time
+        if (atomic_load(&pEmulator->rewinding) && pEmulator->hLog == NULL)
+        {
+            // Steps back a frame instead of running one, the audio clock keeps going and stays silent
+            uint64_t audio_cycles = chip8_get_cycles(pEmulator->hChip8) + audio_offset + chip8_get_ips(pEmulator->hChip8) / FRAME_RATE;
+            rewind_pop(pEmulator->hRewind, pEmulator->hChip8);
+            audio_offset = audio_cycles - chip8_get_cycles(pEmulator->hChip8);
+            audio_update(pEmulator->hAudio, audio_cycles, 0);
+        }
+        else
+        {
+            // The state at the start of every frame is recorded so rewinding lands on frame boundaries
+            rewind_push(pEmulator->hRewind, pEmulator->hChip8);
+
+            // Run the frame's instructions in one batch, it returns early for draws, FX18 and when FX0A waits for a key
+            // Audio is synthesized up to every return so a tone starts and stops on the cycle FX18 ran
+            RunStatus status;
+            do
+            {
+                status = chip8_run_frame(pEmulator->hChip8);
+                audio_update(pEmulator->hAudio, chip8_get_cycles(pEmulator->hChip8) + audio_offset, chip8_get_sound_cycles(pEmulator->hChip8));
+            } while (status == RUN_DRAW || status == RUN_SOUND);
+        }
+
+        unsigned int sequence = chip8_get_frame_sequence(pEmulator->hChip8);
+        if (sequence != published_sequence)
+        {
+            publish_frame(pEmulator, sequence);
+            published_sequence = sequence;
+            glfwPostEmptyEvent();
+        }
+
+        pacer_wait(hPacer);
+    }
+
+    pacer_print_stats(hPacer);
+    rewind_print_stats(pEmulator->hRewind);
+    pacer_destroy(&hPacer);
+    return NULL;
+}
+
+void publish_frame(Emulator* pEmulator, unsigned int sequence)
+{
+    Frame* pFrame = triple_buffer_back(pEmulator->hFrames);
+    memcpy(pFrame->rows, chip8_get_gfx_packed(pEmulator->hChip8), sizeof(pFrame->rows));
+    pFrame->dirty_rows = chip8_get_dirty_rows(pEmulator->hChip8);
+    pFrame->sequence = sequence;
+    triple_buffer_publish(pEmulator->hFrames);
+    chip8_clear_dirty_rows(pEmulator->hChip8);
+}
+
 unsigned int create_shader(const char* vertex_shader, const char* fragment_shader)
 {
     unsigned int program = glCreateProgram();
@@ -174,83 +447,55 @@ unsigned int compile_shader(unsigned int type, const char* source)
     return id;
 }
 
-void draw_frame(unsigned char* gfx, int window_width, int window_height)
+// Uploads the dirty rows that differ from what is in the screen texture and redraws it with a single call
+// Returns FALSE without drawing when nothing changed, e.g. a sprite was drawn and erased again in the same frame
+Boolean draw_frame(uint64_t* presented, const uint64_t* gfx, uint32_t dirty_rows)
 {
-    float width = (float)window_width / 2;
-    float height = (float)window_height / 2;
-    float width_modifer = (float)window_width / (float)SCREEN_WIDTH;
-    float height_modifer = (float)window_height / (float)SCREEN_HEIGHT;
-    float vertices[8];
-    unsigned int elements[] = {0, 3, 1, 1, 2, 0}; // Order of drawing verticies to get the triangle
-
-    glClear(GL_COLOR_BUFFER_BIT);
-    for (int r = 0; r < SCREEN_HEIGHT; r++)
+    Boolean changed = FALSE;
+    int r = 0;
+    while (r < SCREEN_HEIGHT)
     {
-        for (int c = 0; c < SCREEN_WIDTH; c++)
+        if (!(dirty_rows >> r & 1) || gfx[r] == presented[r])
         {
-            if (gfx[r * SCREEN_WIDTH + c] != 0)
-            {
-                vertices[0] = ((((float)c * width_modifer) - width) / width);
-                vertices[1] = -((((float)r * height_modifer) - height) / height) - 0.05;
-                // Bottom Right X and Y
-                vertices[2] = ((((float)c * width_modifer) - width) / width) + (width_modifer / width);
-                vertices[3] = -((((float)r * height_modifer) - height) / height) + (height_modifer / height) - 0.05;
-                // Top Right X and Y
-                vertices[4] = ((((float)c * width_modifer) - width) / width) + (width_modifer / width);
-                vertices[5] = -((((float)r * height_modifer) - height) / height) - 0.05;
-                // Bottom Left X and Y
-                vertices[6] = ((((float)c * width_modifer) - width) / width);
-                vertices[7] = -((((float)r * height_modifer) - height) / height) + (height_modifer / height) - 0.05;
-
-                glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_DYNAMIC_DRAW);
-
-                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-            }
+            r++;
+            continue;
         }
+        // Upload each run of changed rows in one call
+        int start = r;
+        while (r < SCREEN_HEIGHT && (dirty_rows >> r & 1) && gfx[r] != presented[r])
+        {
+            presented[r] = gfx[r];
+            r++;
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, start, 1, r - start, GL_RG_INTEGER, GL_UNSIGNED_INT, &gfx[start]);
+        changed = TRUE;
     }
-}
+    if (!changed)
+        return FALSE;
 
-void handle_keys(GLFWwindow* window, Boolean* exit_flag)
-{
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS) chip8_set_key(hChip8, 0x1, 1);
-    else                                              chip8_set_key(hChip8, 0x1, 0);
-    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS) chip8_set_key(hChip8, 0x2, 1);
-    else                                              chip8_set_key(hChip8, 0x2, 0);
-    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS) chip8_set_key(hChip8, 0x3, 1);
-    else                                              chip8_set_key(hChip8, 0x3, 0);
-    if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS) chip8_set_key(hChip8, 0xC, 1);
-    else                                              chip8_set_key(hChip8, 0xC, 0);
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) chip8_set_key(hChip8, 0x4, 1);
-    else                                              chip8_set_key(hChip8, 0x4, 0);
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) chip8_set_key(hChip8, 0x5, 1);
-    else                                              chip8_set_key(hChip8, 0x5, 0);
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) chip8_set_key(hChip8, 0x6, 1);
-    else                                              chip8_set_key(hChip8, 0x6, 0);
-    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) chip8_set_key(hChip8, 0xD, 1);
-    else                                              chip8_set_key(hChip8, 0xD, 0);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) chip8_set_key(hChip8, 0x7, 1);
-    else                                              chip8_set_key(hChip8, 0x7, 0);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) chip8_set_key(hChip8, 0x8, 1);
-    else                                              chip8_set_key(hChip8, 0x8, 0);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) chip8_set_key(hChip8, 0x9, 1);
-    else                                              chip8_set_key(hChip8, 0x9, 0);
-    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) chip8_set_key(hChip8, 0xE, 1);
-    else                                              chip8_set_key(hChip8, 0xE, 0);
-    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) chip8_set_key(hChip8, 0xA, 1);
-    else                                              chip8_set_key(hChip8, 0xA, 0);
-    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) chip8_set_key(hChip8, 0x0, 1);
-    else                                              chip8_set_key(hChip8, 0x0, 0);
-    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) chip8_set_key(hChip8, 0xB, 1);
-    else                                              chip8_set_key(hChip8, 0xB, 0);
-    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS) chip8_set_key(hChip8, 0xF, 1);
-    else                                              chip8_set_key(hChip8, 0xF, 0);
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) debug = TRUE;
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) *exit_flag = TRUE;
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    return TRUE;
 }
 
-void sleep(unsigned int mseconds)
+// Runs on the render thread from glfwWaitEvents, hands CHIP8 key changes to the emulation thread
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-    clock_t goal = mseconds + clock();
-    while (goal > clock());
-}
\ No newline at end of file
+    Emulator* pEmulator = (Emulator*)glfwGetWindowUserPointer(window);
+    if (action == GLFW_REPEAT)
+        return;
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    if (key == GLFW_KEY_P && action == GLFW_PRESS && pEmulator->debug_enabled)
+        atomic_store(&pEmulator->debug, 1);
+    if (key == GLFW_KEY_BACKSPACE)
+        atomic_store(&pEmulator->rewinding, action == GLFW_PRESS);
+    for (int i = 0; i < NUM_OF_KEYS; i++)
+    {
+        if (key_map[i] == key)
+        {
+            InputEvent event = {i, action == GLFW_PRESS};
+            input_queue_push(pEmulator->hInput, event);
+        }
+    }
+}
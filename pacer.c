@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include "pacer.h"
+
+#define NANOSECONDS 1000000000LL
+#define MAX_TICKS_BEHIND 4 // Further behind than this the pacer starts over instead of running ticks back to back
+
+typedef struct pacer
+{
+    int rate;
+    long long start;  // Time of tick 0
+    long long ticks;  // Ticks since start
+    long long frames; // Ticks waited for in total, kept across restarts
+    long long skipped;
+    double late_sum;
+    double late_squares;
+    long long late_max;
+} Pacer;
+
+static long long pacer_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NANOSECONDS + now.tv_nsec;
+}
+
+PACER pacer_init_default(int rate)
+{
+    Pacer* pPacer = (Pacer*)calloc(1, sizeof(Pacer));
+    if (pPacer != NULL)
+    {
+        pPacer->rate = rate;
+        pPacer->start = pacer_now();
+    }
+    return pPacer;
+}
+
+void pacer_wait(PACER hPacer)
+{
+    Pacer* pPacer = (Pacer*)hPacer;
+
+    // Deadlines come from the tick count rather than adding up a rounded period, so they never drift
+    pPacer->ticks++;
+    long long deadline = pPacer->start + pPacer->ticks * NANOSECONDS / pPacer->rate;
+    struct timespec wake = {deadline / NANOSECONDS, deadline % NANOSECONDS};
+    // Sleeps again when a signal interrupts it, any other error gives up and the frame counts as late
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+        ;
+
+    long long late = pacer_now() - deadline;
+    pPacer->frames++;
+    pPacer->late_sum += late;
+    pPacer->late_squares += (double)late * late;
+    if (late > pPacer->late_max)
+        pPacer->late_max = late;
+
+    // After a long stall (debugger, suspended process...) start counting from now instead of catching up
+    if (late > MAX_TICKS_BEHIND * NANOSECONDS / pPacer->rate)
+    {
+        pPacer->skipped += late * pPacer->rate / NANOSECONDS;
+        pPacer->start = pacer_now();
+        pPacer->ticks = 0;
+    }
+}
+
+void pacer_print_stats(PACER hPacer)
+{
+    Pacer* pPacer = (Pacer*)hPacer;
+    if (pPacer->frames == 0)
+        return;
+    double mean = pPacer->late_sum / pPacer->frames;
+    double variance = pPacer->late_squares / pPacer->frames - mean * mean;
+    double deviation = variance > 0 ? sqrt(variance) : 0;
+    printf("Pacing: %lld ticks at %d Hz, late by %.3f ms on average (deviation %.3f ms, worst %.3f ms), %lld ticks skipped\n",
+           pPacer->frames, pPacer->rate, mean / 1000000.0, deviation / 1000000.0, pPacer->late_max / 1000000.0, pPacer->skipped);
+}
+
+void pacer_destroy(PACER* phPacer)
+{
+    free(*phPacer);
+    *phPacer = NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef PACER_H
+#define PACER_H
+
+// Sleeps a thread until fixed ticks on the monotonic clock, e.g. 60 times a second for frames
+// Deadlines are absolute so oversleeping one tick never delays the ones after it
+
+typedef void* PACER;
+
+PACER pacer_init_default(int rate);
+// Sleeps until the next tick, returns straight away if it already passed
+void pacer_wait(PACER hPacer);
+// Prints how late the wake ups were compared to their deadlines
+void pacer_print_stats(PACER hPacer);
+void pacer_destroy(PACER* phPacer);
+
+#endif
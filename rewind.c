@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rewind.h"
+
+// States are encoded a word at a time as tokens, a count of words equal to the base state and a count of
+// literal words that follow holding the XOR with the base. Keyframes use an all zero base
+// The encoded states sit back to back in one ring of bytes, a state that does not fit before the end of
+// it starts over at the beginning and the oldest ones are dropped until there is room
+
+#define NANOSECONDS 1000000000LL
+#define NO_KEYFRAME UINT64_MAX
+
+typedef struct token
+{
+    uint16_t same;    // Words equal to the base
+    uint16_t literal; // Words that follow the token
+} Token;
+
+typedef struct record
+{
+    size_t offset;     // Start of the encoded state in data
+    size_t size;
+    uint64_t keyframe; // Serial number of the keyframe it was encoded against, its own for keyframes
+    int depth;         // Pushes since its keyframe, 0 for keyframes
+} Record;
+
+typedef struct rewind_buffer
+{
+    Record* records; // Ring of capacity records, oldest at first
+    int capacity;
+    int first;
+    int count;
+    uint64_t first_serial; // Serial number of the oldest record, every push gets the next one
+    unsigned char* data;
+    size_t data_size;
+    size_t used;
+    int keyframe_interval;
+
+    size_t state_size;       // chip8_state_size, a multiple of 8
+    uint64_t* state;         // The state being pushed or popped
+    uint64_t* key;           // Decoded keyframe
+    uint64_t key_serial;     // Keyframe held in key, NO_KEYFRAME when it holds none
+    uint64_t* zero;          // Base for keyframes
+    unsigned char* encoded;  // The state being pushed
+
+    // Statistics
+    long long pushes;
+    long long keyframes;
+    long long encoded_bytes;
+    long long push_time;
+    long long push_max;
+} RewindBuffer;
+
+static long long rewind_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NANOSECONDS + now.tv_nsec;
+}
+
+static size_t rewind_encode(const uint64_t* state, const uint64_t* base, size_t words, unsigned char* out)
+{
+    size_t size = 0;
+    size_t i = 0;
+    while (i < words)
+    {
+        Token token;
+        size_t start = i;
+        while (i < words && state[i] == base[i])
+            i++;
+        token.same = (uint16_t)(i - start);
+        start = i;
+        while (i < words && state[i] != base[i])
+            i++;
+        token.literal = (uint16_t)(i - start);
+
+        memcpy(out + size, &token, sizeof(token));
+        size += sizeof(token);
+        for (size_t j = start; j < i; j++)
+        {
+            uint64_t word = state[j] ^ base[j];
+            memcpy(out + size, &word, sizeof(word));
+            size += sizeof(word);
+        }
+    }
+    return size;
+}
+
+static void rewind_decode(const unsigned char* in, size_t size, const uint64_t* base, uint64_t* state)
+{
+    size_t i = 0;
+    size_t position = 0;
+    while (position < size)
+    {
+        Token token;
+        memcpy(&token, in + position, sizeof(token));
+        position += sizeof(token);
+        memcpy(state + i, base + i, token.same * sizeof(uint64_t));
+        i += token.same;
+        for (int j = 0; j < token.literal; j++)
+        {
+            uint64_t word;
+            memcpy(&word, in + position, sizeof(word));
+            position += sizeof(word);
+            state[i] = base[i] ^ word;
+            i++;
+        }
+    }
+}
+
+static Record* rewind_record(RewindBuffer* pRewind, uint64_t serial)
+{
+    return &pRewind->records[(pRewind->first + (int)(serial - pRewind->first_serial)) % pRewind->capacity];
+}
+
+// Decodes a keyframe into key unless it is already there, FALSE when it was dropped
+static Boolean rewind_load_keyframe(RewindBuffer* pRewind, uint64_t serial)
+{
+    if (pRewind->key_serial == serial)
+        return TRUE;
+    if (serial < pRewind->first_serial || serial >= pRewind->first_serial + pRewind->count)
+        return FALSE;
+    Record* pRecord = rewind_record(pRewind, serial);
+    rewind_decode(pRewind->data + pRecord->offset, pRecord->size, pRewind->zero, pRewind->key);
+    pRewind->key_serial = serial;
+    return TRUE;
+}
+
+// Drops the oldest keyframe and every state encoded against it
+static void rewind_drop_oldest(RewindBuffer* pRewind)
+{
+    do
+    {
+        pRewind->used -= pRewind->records[pRewind->first].size;
+        pRewind->first = (pRewind->first + 1) % pRewind->capacity;
+        pRewind->first_serial++;
+        pRewind->count--;
+    } while (pRewind->count > 0 && pRewind->records[pRewind->first].depth != 0);
+}
+
+// Finds room for size bytes after the newest state without overwriting the oldest one
+static Boolean rewind_reserve(RewindBuffer* pRewind, size_t size, size_t* pOffset)
+{
+    if (pRewind->count == 0)
+    {
+        *pOffset = 0;
+        return size <= pRewind->data_size;
+    }
+    if (pRewind->count == pRewind->capacity)
+        return FALSE;
+
+    Record* pNewest = rewind_record(pRewind, pRewind->first_serial + pRewind->count - 1);
+    size_t head = pNewest->offset + pNewest->size;
+    size_t tail = pRewind->records[pRewind->first].offset;
+    if (pNewest->offset >= tail)
+    {
+        // Free space is after the newest state and before the oldest one
+        if (head + size <= pRewind->data_size)
+            *pOffset = head;
+        else if (size <= tail)
+            *pOffset = 0;
+        else
+            return FALSE;
+    }
+    else if (head + size <= tail)
+        *pOffset = head;
+    else
+        return FALSE;
+    return TRUE;
+}
+
+REWIND rewind_init_default(int frames, size_t bytes, int keyframe_interval)
+{
+    RewindBuffer* pRewind = (RewindBuffer*)calloc(1, sizeof(RewindBuffer));
+    if (pRewind == NULL)
+        return NULL;
+
+    pRewind->capacity = frames;
+    pRewind->data_size = bytes;
+    pRewind->keyframe_interval = keyframe_interval;
+    pRewind->key_serial = NO_KEYFRAME;
+    pRewind->state_size = chip8_state_size();
+    size_t words = pRewind->state_size / sizeof(uint64_t);
+    pRewind->records = (Record*)malloc(frames * sizeof(Record));
+    pRewind->data = (unsigned char*)malloc(bytes);
+    pRewind->state = (uint64_t*)malloc(pRewind->state_size);
+    pRewind->key = (uint64_t*)malloc(pRewind->state_size);
+    pRewind->zero = (uint64_t*)calloc(words, sizeof(uint64_t));
+    // Worst case is one token per word
+    pRewind->encoded = (unsigned char*)malloc(words * (sizeof(Token) + sizeof(uint64_t)));
+    if (pRewind->records == NULL || pRewind->data == NULL || pRewind->state == NULL || pRewind->key == NULL ||
+        pRewind->zero == NULL || pRewind->encoded == NULL)
+    {
+        rewind_destroy((REWIND*)&pRewind);
+        return NULL;
+    }
+    return pRewind;
+}
+
+Status rewind_push(REWIND hRewind, CHIP8 hChip8)
+{
+    RewindBuffer* pRewind = (RewindBuffer*)hRewind;
+    long long start = rewind_now();
+    size_t words = pRewind->state_size / sizeof(uint64_t);
+    chip8_save_state(hChip8, pRewind->state, pRewind->state_size, FALSE);
+
+    uint64_t serial = pRewind->first_serial + pRewind->count;
+    Record* pNewest = pRewind->count > 0 ? rewind_record(pRewind, serial - 1) : NULL;
+    Boolean keyframe = pNewest == NULL || pNewest->depth + 1 >= pRewind->keyframe_interval ||
+                       !rewind_load_keyframe(pRewind, pNewest->keyframe);
+    size_t size = rewind_encode(pRewind->state, keyframe ? pRewind->zero : pRewind->key, words, pRewind->encoded);
+
+    size_t offset;
+    while (!rewind_reserve(pRewind, size, &offset))
+    {
+        if (pRewind->count == 0)
+            return FAILURE;
+        // The state's own keyframe is the oldest one left, it has to become a keyframe itself
+        if (!keyframe && pRewind->first_serial == pNewest->keyframe)
+        {
+            keyframe = TRUE;
+            size = rewind_encode(pRewind->state, pRewind->zero, words, pRewind->encoded);
+            continue;
+        }
+        rewind_drop_oldest(pRewind);
+    }
+
+    memcpy(pRewind->data + offset, pRewind->encoded, size);
+    pRewind->count++;
+    Record* pRecord = rewind_record(pRewind, serial);
+    pRecord->offset = offset;
+    pRecord->size = size;
+    pRecord->keyframe = keyframe ? serial : pNewest->keyframe;
+    pRecord->depth = keyframe ? 0 : pNewest->depth + 1;
+    pRewind->used += size;
+    if (keyframe)
+    {
+        memcpy(pRewind->key, pRewind->state, pRewind->state_size);
+        pRewind->key_serial = serial;
+        pRewind->keyframes++;
+    }
+
+    long long elapsed = rewind_now() - start;
+    pRewind->pushes++;
+    pRewind->encoded_bytes += size;
+    pRewind->push_time += elapsed;
+    if (elapsed > pRewind->push_max)
+        pRewind->push_max = elapsed;
+    return SUCCESS;
+}
+
+Status rewind_pop(REWIND hRewind, CHIP8 hChip8)
+{
+    RewindBuffer* pRewind = (RewindBuffer*)hRewind;
+    if (pRewind->count == 0)
+        return FAILURE;
+
+    uint64_t serial = pRewind->first_serial + pRewind->count - 1;
+    Record* pRecord = rewind_record(pRewind, serial);
+    if (!rewind_load_keyframe(pRewind, pRecord->keyframe))
+        return FAILURE;
+    if (pRecord->depth == 0)
+        memcpy(pRewind->state, pRewind->key, pRewind->state_size);
+    else
+        rewind_decode(pRewind->data + pRecord->offset, pRecord->size, pRewind->key, pRewind->state);
+
+    pRewind->count--;
+    pRewind->used -= pRecord->size;
+    // The next push reuses the serial number
+    if (pRewind->key_serial == serial)
+        pRewind->key_serial = NO_KEYFRAME;
+    return chip8_load_state(hChip8, pRewind->state, pRewind->state_size);
+}
+
+int rewind_get_frames(REWIND hRewind)
+{
+    RewindBuffer* pRewind = (RewindBuffer*)hRewind;
+    return pRewind->count;
+}
+
+size_t rewind_get_bytes_used(REWIND hRewind)
+{
+    RewindBuffer* pRewind = (RewindBuffer*)hRewind;
+    return pRewind->used;
+}
+
+void rewind_print_stats(REWIND hRewind)
+{
+    RewindBuffer* pRewind = (RewindBuffer*)hRewind;
+    if (pRewind->pushes == 0)
+        return;
+    printf("Rewind: %d frames held (%.1f s) in %.2f of %.2f MB, %.0f bytes per state against %zu uncompressed, %lld keyframes\n",
+           pRewind->count, (double)pRewind->count / FRAME_RATE, pRewind->used / 1048576.0, pRewind->data_size / 1048576.0,
+           (double)pRewind->encoded_bytes / pRewind->pushes, pRewind->state_size, pRewind->keyframes);
+    printf("Rewind: pushes took %.3f us on average (worst %.3f us)\n",
+           pRewind->push_time / 1000.0 / pRewind->pushes, pRewind->push_max / 1000.0);
+}
+
+void rewind_destroy(REWIND* phRewind)
+{
+    RewindBuffer* pRewind = (RewindBuffer*)*phRewind;
+    free(pRewind->records);
+    free(pRewind->data);
+    free(pRewind->state);
+    free(pRewind->key);
+    free(pRewind->zero);
+    free(pRewind->encoded);
+    free(pRewind);
+    *phRewind = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include "chip8.h"
+
+// Fixed size history of save states for rewinding, pushed once per frame and popped newest first
+// Every keyframe_interval pushes a keyframe is stored, the states in between are stored as the XOR with
+// their keyframe, and both are run length encoded so a frame usually takes a few hundred bytes
+// When the memory runs out the oldest keyframe is dropped together with the states that depend on it
+
+typedef void* REWIND;
+
+// frames bounds how many states are held and bytes how much memory they take together
+REWIND rewind_init_default(int frames, size_t bytes, int keyframe_interval);
+// Records the current state of the CHIP8, FAILURE when a single state does not fit in the memory
+Status rewind_push(REWIND hRewind, CHIP8 hChip8);
+// Restores the newest state and drops it, FAILURE when the history is empty
+Status rewind_pop(REWIND hRewind, CHIP8 hChip8);
+int rewind_get_frames(REWIND hRewind);
+// Bytes taken by the encoded states, at most the bytes given at init
+size_t rewind_get_bytes_used(REWIND hRewind);
+// Prints how much history is held, how well it compressed and how long pushes took
+void rewind_print_stats(REWIND hRewind);
+void rewind_destroy(REWIND* phRewind);
+
+#endif
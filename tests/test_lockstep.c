@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include "chip8.h"
+#include "lockstep.h"
+
+// Lockstep lanes end in the same state as a CHIP8 run alone, grouped with AVX2 or one lane at a time
+
+#define CYCLES 1000
+#define LANES 33 // A full register of lanes and one more
+
+static int check_rom(const char* name, const unsigned char* rom, size_t size)
+{
+    CHIP8 hChip8 = chip8_init_default();
+    if (hChip8 == NULL || chip8_load_rom_memory(hChip8, rom, size) == FAILURE)
+    {
+        printf("%s: failed to load the rom\n", name);
+        return 1;
+    }
+    chip8_seed(hChip8, 0);
+    chip8_run_cycles(hChip8, CYCLES, NULL);
+    uint32_t expected = chip8_get_state_hash(hChip8);
+    chip8_destory(&hChip8);
+
+    int failures = 0;
+    for (int vector = 0; vector < 2; vector++)
+    {
+        FILE* fp = tmpfile();
+        LOCKSTEP hLockstep = lockstep_init_default(LANES);
+        if (fp == NULL || hLockstep == NULL || fwrite(rom, 1, size, fp) != size)
+        {
+            printf("%s: failed to set up the lanes\n", name);
+            return failures + 1;
+        }
+        rewind(fp);
+        Status loaded = lockstep_load_rom(hLockstep, fp);
+        fclose(fp);
+        if (loaded == FAILURE)
+        {
+            printf("%s: failed to load the rom into the lanes\n", name);
+            lockstep_destroy(&hLockstep);
+            return failures + 1;
+        }
+        if (lockstep_set_vector(hLockstep, vector) == FAILURE)
+        {
+            lockstep_destroy(&hLockstep);
+            continue;
+        }
+        for (int lane = 0; lane < LANES; lane++)
+            lockstep_seed(hLockstep, lane, 0);
+        lockstep_run_cycles(hLockstep, CYCLES);
+        for (int lane = 0; lane < LANES; lane++)
+        {
+            uint32_t hash = lockstep_get_state_hash(hLockstep, lane);
+            if (hash != expected)
+            {
+                printf("%s: %s lane %d ended in state %08x, a CHIP8 in %08x\n", name, vector ? "grouped" : "scalar",
+                       lane, hash, expected);
+                failures++;
+                break;
+            }
+        }
+        lockstep_destroy(&hLockstep);
+    }
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    // Shifts with VF as X set VF to the flag and then shift the flag, each rom ends spinning on its last jump
+    const unsigned char shift_right[] = {0x6F, 0x83, 0x8F, 0x06, 0x12, 0x04};
+    const unsigned char shift_left[] = {0x6F, 0x83, 0x8F, 0x0E, 0x12, 0x04};
+    failures += check_rom("8FY6", shift_right, sizeof(shift_right));
+    failures += check_rom("8FYE", shift_left, sizeof(shift_left));
+
+    // Arithmetic with VF as X and as Y
+    const unsigned char arithmetic[] = {0x6F, 0xC8, 0x61, 0x9D, 0x8F, 0x14, 0x81, 0xF5, 0x8F, 0x17, 0x81, 0xF4, 0x12, 0x0C};
+    failures += check_rom("8XY4 8XY5 8XY7 with VF", arithmetic, sizeof(arithmetic));
+
+    if (failures == 0)
+        printf("lockstep lanes match a CHIP8\n");
+    return failures == 0 ? 0 : 1;
+}
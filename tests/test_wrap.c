@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+// pc wraps at the end of memory like every other address, BNNN and skips that run past 0xFFF have to land
+// back in memory on every core and leave them all in the same state
+
+#define ROM_SIZE (MEMORY_SIZE - 0x200)
+#define CYCLES 100000
+
+static void put(unsigned char* rom, int address, unsigned short opcode)
+{
+    rom[address - 0x200] = opcode >> 8;
+    rom[address - 0x200 + 1] = opcode & 0xFF;
+}
+
+static int run_cores(const char* name, const unsigned char* rom)
+{
+    const char* core_names[] = {"interpreter", "threaded", "jit"};
+    Core cores[] = {CORE_INTERPRETER, CORE_THREADED, CORE_JIT};
+    uint32_t expected = 0;
+    int failures = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        CHIP8 hChip8 = chip8_init_default();
+        if (hChip8 == NULL || chip8_load_rom_memory(hChip8, rom, ROM_SIZE) == FAILURE)
+        {
+            printf("%s: failed to load the rom\n", name);
+            return 1;
+        }
+        if (chip8_set_core(hChip8, cores[i]) == FAILURE)
+        {
+            chip8_destory(&hChip8);
+            continue;
+        }
+        chip8_set_report_unknown(hChip8, FALSE);
+        while (chip8_get_cycles(hChip8) < CYCLES)
+            chip8_run_cycles(hChip8, 1000, NULL);
+
+        uint32_t hash = chip8_get_state_hash(hChip8);
+        if (i == 0)
+            expected = hash;
+        else if (hash != expected)
+        {
+            printf("%s: %s ended in state %08x, the interpreter in %08x\n", name, core_names[i], hash, expected);
+            failures++;
+        }
+        chip8_destory(&hChip8);
+    }
+    return failures;
+}
+
+// A machine stopped with pc past the end of memory saves and loads back to the same state
+static int save_and_load(const char* name, const unsigned char* rom, int cycles)
+{
+    CHIP8 hChip8 = chip8_init_default();
+    if (hChip8 == NULL || chip8_load_rom_memory(hChip8, rom, ROM_SIZE) == FAILURE)
+    {
+        printf("%s: failed to load the rom\n", name);
+        return 1;
+    }
+    chip8_set_report_unknown(hChip8, FALSE);
+    chip8_run_cycles(hChip8, cycles, NULL);
+
+    size_t size = chip8_state_size();
+    unsigned char* state = (unsigned char*)malloc(size);
+    int failures = 0;
+    uint32_t expected = chip8_get_state_hash(hChip8);
+    if (state == NULL || chip8_save_state(hChip8, state, size, TRUE) == FAILURE)
+    {
+        printf("%s: failed to save the state\n", name);
+        failures++;
+    }
+    else
+    {
+        chip8_run_cycles(hChip8, 1000, NULL);
+        if (chip8_load_state(hChip8, state, size) == FAILURE)
+        {
+            printf("%s: the saved state did not load\n", name);
+            failures++;
+        }
+        else if (chip8_get_state_hash(hChip8) != expected)
+        {
+            printf("%s: the loaded state hashes to %08x, it was saved as %08x\n", name, chip8_get_state_hash(hChip8), expected);
+            failures++;
+        }
+    }
+    free(state);
+    chip8_destory(&hChip8);
+    return failures;
+}
+
+int main(void)
+{
+    unsigned char rom[ROM_SIZE];
+    int failures = 0;
+
+    // BNNN to 0x10FE, runs the zeroed memory after the font up to the rom and around again
+    memset(rom, 0, sizeof(rom));
+    put(rom, 0x200, 0x60FF);
+    put(rom, 0x202, 0xBFFF);
+    failures += run_cores("BNNN past 0xFFF", rom);
+    // Saved with pc at 0x10FE
+    failures += save_and_load("BNNN past 0xFFF", rom, 2);
+
+    // A skip in the last instruction of memory
+    memset(rom, 0, sizeof(rom));
+    put(rom, 0x200, 0x1FFE);
+    put(rom, 0xFFE, 0x3000);
+    failures += run_cores("skip at 0xFFE", rom);
+
+    if (failures == 0)
+        printf("pc wraps on every core\n");
+    return failures == 0 ? 0 : 1;
+}
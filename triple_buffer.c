@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "triple_buffer.h"
+
+// The three frames rotate between the writer (back), the reader (front) and the slot in between (middle)
+// middle holds a frame index plus FRESH_BIT when it was published and not acquired yet, swapping it
+// atomically is the only synchronization needed
+
+#define FRESH_BIT 0x4
+
+typedef struct triple_buffer
+{
+    Frame frames[3];
+    int back;
+    int front;
+    atomic_int middle;
+} TripleBuffer;
+
+TRIPLE_BUFFER triple_buffer_init_default(void)
+{
+    TripleBuffer* pBuffer = (TripleBuffer*)malloc(sizeof(TripleBuffer));
+    if (pBuffer != NULL)
+    {
+        memset(pBuffer->frames, 0, sizeof(pBuffer->frames));
+        pBuffer->back = 0;
+        pBuffer->front = 1;
+        atomic_init(&pBuffer->middle, 2);
+    }
+    return pBuffer;
+}
+
+Frame* triple_buffer_back(TRIPLE_BUFFER hBuffer)
+{
+    TripleBuffer* pBuffer = (TripleBuffer*)hBuffer;
+    return &pBuffer->frames[pBuffer->back];
+}
+
+void triple_buffer_publish(TRIPLE_BUFFER hBuffer)
+{
+    TripleBuffer* pBuffer = (TripleBuffer*)hBuffer;
+    Frame* pBack = &pBuffer->frames[pBuffer->back];
+
+    // A frame still waiting in the middle gets dropped by this publish, carry its dirty rows over so the
+    // reader still redraws them. If the reader takes it in the meantime the rows are only redrawn twice
+    int middle = atomic_load_explicit(&pBuffer->middle, memory_order_acquire);
+    if (middle & FRESH_BIT)
+        pBack->dirty_rows |= pBuffer->frames[middle & ~FRESH_BIT].dirty_rows;
+
+    middle = atomic_exchange_explicit(&pBuffer->middle, pBuffer->back | FRESH_BIT, memory_order_acq_rel);
+    pBuffer->back = middle & ~FRESH_BIT;
+}
+
+const Frame* triple_buffer_acquire(TRIPLE_BUFFER hBuffer)
+{
+    TripleBuffer* pBuffer = (TripleBuffer*)hBuffer;
+    if (atomic_load_explicit(&pBuffer->middle, memory_order_relaxed) & FRESH_BIT)
+    {
+        int middle = atomic_exchange_explicit(&pBuffer->middle, pBuffer->front, memory_order_acq_rel);
+        pBuffer->front = middle & ~FRESH_BIT;
+    }
+    return &pBuffer->frames[pBuffer->front];
+}
+
+void triple_buffer_destroy(TRIPLE_BUFFER* phBuffer)
+{
+    free(*phBuffer);
+    *phBuffer = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// Lock free triple buffer that hands finished frames from the emulation thread to the render thread
+// One thread writes into the back frame and publishes it, the other acquires the newest published frame,
+// neither ever waits on the other and frames the reader was too slow to see are dropped
+
+typedef void* TRIPLE_BUFFER;
+
+typedef struct frame
+{
+    uint64_t rows[SCREEN_HEIGHT];
+    uint32_t dirty_rows;   // Rows that may differ from the frame published before it, includes rows of dropped frames
+    unsigned int sequence; // chip8_get_frame_sequence when the frame was published
+} Frame;
+
+TRIPLE_BUFFER triple_buffer_init_default(void);
+// Writer side, fill the back frame then publish it
+Frame* triple_buffer_back(TRIPLE_BUFFER hBuffer);
+void triple_buffer_publish(TRIPLE_BUFFER hBuffer);
+// Reader side, returns the newest published frame which stays valid until the next acquire
+const Frame* triple_buffer_acquire(TRIPLE_BUFFER hBuffer);
+void triple_buffer_destroy(TRIPLE_BUFFER* phBuffer);
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "work_pool.h"
+
+// Every worker owns a share of the batch, a range of item numbers. The owner takes items from the end of
+// its range and thieves take them from the start, each share has its own lock so workers only ever wait
+// on each other while taking a single item
+
+typedef struct share
+{
+    pthread_mutex_t lock;
+    int top;    // Next item a thief takes
+    int bottom; // One past the next item the owner takes
+} Share;
+
+typedef struct work_pool WorkPool;
+
+typedef struct worker
+{
+    WorkPool* pPool;
+    int index;
+} Worker;
+
+struct work_pool
+{
+    int thread_count;
+    pthread_t* threads;
+    Worker* workers;
+    Share* shares;
+
+    pthread_mutex_t lock;     // Guards everything below
+    pthread_cond_t start;     // A batch was posted or the pool is stopping
+    pthread_cond_t finished;  // The last item of the batch is done
+    unsigned long batch;      // Batches posted so far
+    int items_left;
+    int stopping;
+    WorkFunction function;
+    void* context;
+
+    atomic_llong steals;
+};
+
+// Takes an item from the worker's own share or steals one from the next worker that has any left
+static int work_pool_take(WorkPool* pPool, int index, int* pItem)
+{
+    Share* pShare = &pPool->shares[index];
+    pthread_mutex_lock(&pShare->lock);
+    int found = pShare->bottom > pShare->top;
+    if (found)
+        *pItem = --pShare->bottom;
+    pthread_mutex_unlock(&pShare->lock);
+
+    for (int i = 1; !found && i < pPool->thread_count; i++)
+    {
+        pShare = &pPool->shares[(index + i) % pPool->thread_count];
+        pthread_mutex_lock(&pShare->lock);
+        found = pShare->bottom > pShare->top;
+        if (found)
+            *pItem = pShare->top++;
+        pthread_mutex_unlock(&pShare->lock);
+        if (found)
+            atomic_fetch_add_explicit(&pPool->steals, 1, memory_order_relaxed);
+    }
+    return found;
+}
+
+static void* work_pool_worker(void* arg)
+{
+    Worker* pWorker = (Worker*)arg;
+    WorkPool* pPool = pWorker->pPool;
+    unsigned long seen = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&pPool->lock);
+        while (pPool->batch == seen && !pPool->stopping)
+            pthread_cond_wait(&pPool->start, &pPool->lock);
+        if (pPool->stopping)
+        {
+            pthread_mutex_unlock(&pPool->lock);
+            return NULL;
+        }
+        seen = pPool->batch;
+        WorkFunction function = pPool->function;
+        void* context = pPool->context;
+        pthread_mutex_unlock(&pPool->lock);
+
+        int item;
+        while (work_pool_take(pPool, pWorker->index, &item))
+        {
+            function(context, item, pWorker->index);
+            pthread_mutex_lock(&pPool->lock);
+            if (--pPool->items_left == 0)
+                pthread_cond_signal(&pPool->finished);
+            pthread_mutex_unlock(&pPool->lock);
+        }
+    }
+}
+
+WORK_POOL work_pool_init_default(int threads)
+{
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    WorkPool* pPool = (WorkPool*)calloc(1, sizeof(WorkPool));
+    if (pPool == NULL)
+        return NULL;
+    pPool->threads = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    pPool->workers = (Worker*)malloc(threads * sizeof(Worker));
+    pPool->shares = (Share*)malloc(threads * sizeof(Share));
+    if (pPool->threads == NULL || pPool->workers == NULL || pPool->shares == NULL)
+    {
+        free(pPool->threads);
+        free(pPool->workers);
+        free(pPool->shares);
+        free(pPool);
+        return NULL;
+    }
+    pthread_mutex_init(&pPool->lock, NULL);
+    pthread_cond_init(&pPool->start, NULL);
+    pthread_cond_init(&pPool->finished, NULL);
+    atomic_init(&pPool->steals, 0);
+
+    // A pool that could not start every thread it asked for carries on with the ones it got
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_mutex_init(&pPool->shares[i].lock, NULL);
+        pPool->shares[i].top = 0;
+        pPool->shares[i].bottom = 0;
+        pPool->workers[i].pPool = pPool;
+        pPool->workers[i].index = i;
+        if (pthread_create(&pPool->threads[i], NULL, work_pool_worker, &pPool->workers[i]) != 0)
+        {
+            pthread_mutex_destroy(&pPool->shares[i].lock);
+            break;
+        }
+        pPool->thread_count = i + 1;
+    }
+    if (pPool->thread_count == 0)
+    {
+        work_pool_destroy((WORK_POOL*)&pPool);
+        return NULL;
+    }
+    return pPool;
+}
+
+int work_pool_get_threads(WORK_POOL hPool)
+{
+    WorkPool* pPool = (WorkPool*)hPool;
+    return pPool->thread_count;
+}
+
+void work_pool_run(WORK_POOL hPool, int items, WorkFunction function, void* context)
+{
+    WorkPool* pPool = (WorkPool*)hPool;
+    if (items <= 0)
+        return;
+
+    pthread_mutex_lock(&pPool->lock);
+    pPool->function = function;
+    pPool->context = context;
+    pPool->items_left = items;
+    for (int i = 0; i < pPool->thread_count; i++)
+    {
+        Share* pShare = &pPool->shares[i];
+        pthread_mutex_lock(&pShare->lock);
+        pShare->top = (int)((long long)items * i / pPool->thread_count);
+        pShare->bottom = (int)((long long)items * (i + 1) / pPool->thread_count);
+        pthread_mutex_unlock(&pShare->lock);
+    }
+    pPool->batch++;
+    pthread_cond_broadcast(&pPool->start);
+    while (pPool->items_left > 0)
+        pthread_cond_wait(&pPool->finished, &pPool->lock);
+    pthread_mutex_unlock(&pPool->lock);
+}
+
+long long work_pool_get_steals(WORK_POOL hPool)
+{
+    WorkPool* pPool = (WorkPool*)hPool;
+    return atomic_load(&pPool->steals);
+}
+
+void work_pool_destroy(WORK_POOL* phPool)
+{
+    WorkPool* pPool = (WorkPool*)*phPool;
+    pthread_mutex_lock(&pPool->lock);
+    pPool->stopping = 1;
+    pthread_cond_broadcast(&pPool->start);
+    pthread_mutex_unlock(&pPool->lock);
+    for (int i = 0; i < pPool->thread_count; i++)
+        pthread_join(pPool->threads[i], NULL);
+
+    for (int i = 0; i < pPool->thread_count; i++)
+        pthread_mutex_destroy(&pPool->shares[i].lock);
+    pthread_mutex_destroy(&pPool->lock);
+    pthread_cond_destroy(&pPool->start);
+    pthread_cond_destroy(&pPool->finished);
+    free(pPool->threads);
+    free(pPool->workers);
+    free(pPool->shares);
+    free(pPool);
+    *phPool = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+// Fixed set of worker threads that run batches of independent items, e.g. one CHIP8 instance per item
+// Each worker starts on its own share of a batch and steals from the others once it runs out, so
+// batches of items that take very different times still keep every worker busy to the end
+
+typedef void* WORK_POOL;
+
+// Called once for every item of a batch on one of the workers, worker is 0 to threads - 1
+typedef void (*WorkFunction)(void* context, int item, int worker);
+
+// threads <= 0 uses one thread per online CPU
+WORK_POOL work_pool_init_default(int threads);
+int work_pool_get_threads(WORK_POOL hPool);
+// Runs items 0 to items - 1 and returns once they are all done
+void work_pool_run(WORK_POOL hPool, int items, WorkFunction function, void* context);
+// Items workers took from another worker's share, over every batch
+long long work_pool_get_steals(WORK_POOL hPool);
+void work_pool_destroy(WORK_POOL* phPool);
+
+#endif